@@ -0,0 +1,100 @@
+/* Compares the decoders used by Icon::load against the previous stb_image
+ * code path (stdio read, scalar decode, copy into a vector).
+ *
+ * Usage: decode-benchmark [directory...]
+ *
+ * Without arguments, the hicolor icon theme and the thumbnail cache are used
+ * as fixtures. */
+
+#include "icon.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+static constexpr size_t MAX_FIXTURES = 4000;
+static constexpr size_t ITERATIONS = 5;
+
+static std::optional<Icon> load_with_stb(const std::string &path) {
+  int w, h, comp;
+  void *data = stbi_load(path.c_str(), &w, &h, &comp, 4);
+  if (!data)
+    return std::nullopt;
+
+  std::vector<uint32_t> icon_data(w * h);
+  memcpy(icon_data.data(), data, w * h * 4);
+  free(data);
+
+  return Icon(std::move(icon_data), w, h);
+}
+
+template <typename F>
+static void run(const char *label, const std::vector<std::string> &files,
+                F load) {
+  size_t pixels = 0, failures = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    for (const auto &file : files) {
+      auto icon = load(file);
+      if (icon)
+        pixels += icon->width * icon->height;
+      else
+        failures++;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  size_t decoded = files.size() * ITERATIONS;
+  std::cout << label << ": " << seconds * 1e3 / ITERATIONS << " ms/pass, "
+            << seconds * 1e6 / decoded << " us/image, "
+            << pixels / seconds / 1e6 << " Mpixel/s, "
+            << failures / ITERATIONS << " failures\n";
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> dirs(argv + 1, argv + argc);
+  if (dirs.empty()) {
+    dirs.push_back("/usr/share/icons/hicolor");
+    if (const char *cache = getenv("XDG_CACHE_HOME"))
+      dirs.push_back(std::string(cache) + "/thumbnails");
+    else if (const char *home = getenv("HOME"))
+      dirs.push_back(std::string(home) + "/.cache/thumbnails");
+  }
+
+  std::vector<std::string> files;
+  for (const auto &dir : dirs) {
+    std::error_code error;
+    for (auto it = fs::recursive_directory_iterator(dir, error);
+         it != fs::recursive_directory_iterator() &&
+           files.size() < MAX_FIXTURES;
+         it.increment(error)) {
+      auto ext = it->path().extension();
+      if (it->is_regular_file() &&
+          (ext == ".png" || ext == ".jpg" || ext == ".jpeg"))
+        files.push_back(it->path());
+    }
+  }
+
+  std::cout << files.size() << " fixtures, decoders:";
+  for (const ImageDecoder *decoder : image_decoders())
+    std::cout << " " << decoder->name();
+  std::cout << "\n";
+
+  if (files.empty())
+    return 1;
+
+  /* Warm the page cache so that both runs measure decoding only. */
+  for (const auto &file : files)
+    load_with_stb(file);
+
+  run("stb_image (stdio)", files, load_with_stb);
+  run("Icon::load (read_file)", files, [](const std::string &path) {
+    return Icon::load(path);
+  });
+
+  return 0;
+}
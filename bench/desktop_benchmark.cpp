@@ -0,0 +1,179 @@
+/* Compares loading applications through Gio::AppInfo::get_all, as the
+ * launcher used to (get_all, should_show, then sorting by casefolded name),
+ * against DesktopEntryTable: parsing desktop files in parallel on a cold
+ * start, and mapping the snapshot on a warm start.
+ *
+ * Usage: desktop-benchmark [entry count]
+ *
+ * Synthetic desktop files are written to a temporary directory, which is
+ * used as the only XDG data directory. It also has a symbolic link to a
+ * directory of applications and a directory that cannot be read, and the
+ * ids found by the table are checked against those Gio lists. */
+
+#include "desktop_entry_table.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+namespace fs = std::filesystem;
+
+static constexpr size_t DEFAULT_ENTRY_COUNT = 5000;
+static constexpr size_t ITERATIONS = 5;
+
+static const char *const WORDS[] = {
+  "office", "media", "player", "editor", "viewer", "studio", "browser",
+  "terminal", "manager", "settings", "game", "proton", "monitor", "paint",
+};
+
+static void write_fixtures(const fs::path &dir, size_t count) {
+  fs::create_directories(dir / "games");
+  for (size_t i = 0; i < count; i++) {
+    const char *word = WORDS[i % std::size(WORDS)];
+    const char *other = WORDS[(i * 7 + 3) % std::size(WORDS)];
+
+    /* Some applications live in a subdirectory, and a few are hidden. */
+    fs::path path = dir / (i % 4 == 0 ? "games" : "") /
+      ("org.example.App" + std::to_string(i) + ".desktop");
+    std::ofstream out(path);
+    out << "[Desktop Entry]\n"
+        << "Type=Application\n"
+        << "Name=" << other << " " << word << " " << i << "\n"
+        << "Name[de]=" << word << " " << other << " " << i << "\n"
+        << "Name[fr]=" << word << " " << i << "\n"
+        << "GenericName=" << word << " " << other << "\n"
+        << "Comment=Synthetic application number " << i << "\n"
+        << "Keywords=" << word << ";" << other << ";\n"
+        << "Categories=Utility;" << (i % 4 == 0 ? "Game;" : "") << "\n"
+        << "Exec=/usr/bin/app" << i << " %U\n"
+        << "Icon=app-" << word << "\n"
+        << "Terminal=false\n"
+        << (i % 50 == 0 ? "NoDisplay=true\n" : "")
+        << "\n[Desktop Action new-window]\n"
+        << "Name=New Window\n"
+        << "Exec=/usr/bin/app" << i << " --new-window\n";
+  }
+}
+
+/* Applications Gio would show, by desktop file id. */
+static std::set<std::string> gio_ids() {
+  std::set<std::string> ids;
+  for (auto &&app : Gio::AppInfo::get_all()) {
+    if (app->should_show())
+      ids.insert(app->get_id());
+  }
+  return ids;
+}
+
+static std::set<std::string> table_ids(const DesktopEntryTable &table) {
+  std::set<std::string> ids;
+  for (size_t i = 0; i < table.size(); i++)
+    ids.emplace(table.get(i, DesktopField::Id));
+  return ids;
+}
+
+/* Prints the ids only one side has. Returns whether both are the same. */
+static bool compare_ids(const std::set<std::string> &gio,
+                        const std::set<std::string> &table) {
+  bool same = true;
+  for (const std::string &id : gio) {
+    if (!table.count(id)) {
+      std::cout << "  missing from the table: " << id << "\n";
+      same = false;
+    }
+  }
+
+  for (const std::string &id : table) {
+    if (!gio.count(id)) {
+      std::cout << "  not listed by Gio: " << id << "\n";
+      same = false;
+    }
+  }
+
+  return same;
+}
+
+template <typename F>
+static void run(const char *label, F load) {
+  size_t entries = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ITERATIONS; i++)
+    entries = load();
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << label << ": " << seconds * 1e3 / ITERATIONS << " ms/load, "
+            << entries << " applications\n";
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? std::stoul(argv[1]) : DEFAULT_ENTRY_COUNT;
+
+  char tmp_template[] = "/tmp/desktop-benchmark-XXXXXX";
+  if (!mkdtemp(tmp_template)) {
+    std::cerr << "Failed to create a temporary directory\n";
+    return 1;
+  }
+
+  fs::path root = tmp_template;
+  fs::path data_dir = root / "share";
+  write_fixtures(data_dir / "applications", count);
+
+  /* Neither stops the rest of the directory from being read. */
+  write_fixtures(root / "linked", 8);
+  fs::create_directory_symlink(root / "linked",
+                               data_dir / "applications" / "linked");
+  fs::create_directory(data_dir / "applications" / "unreadable");
+  fs::permissions(data_dir / "applications" / "unreadable",
+                  fs::perms::none);
+
+  /* Both Gio and the table only read these once. */
+  setenv("XDG_DATA_HOME", (root / "home").c_str(), 1);
+  setenv("XDG_DATA_DIRS", data_dir.c_str(), 1);
+  setenv("XDG_CACHE_HOME", (root / "cache").c_str(), 1);
+  Gio::init();
+
+  std::cout << count << " desktop files\n";
+
+  run("Gio::AppInfo::get_all + sort", []() {
+    std::vector<Glib::RefPtr<Gio::AppInfo>> apps;
+    for (auto &&app : Gio::AppInfo::get_all()) {
+      if (app->should_show())
+        apps.push_back(app);
+    }
+
+    std::sort(apps.begin(), apps.end(), [](const auto &a, const auto &b) {
+      return Glib::ustring(a->get_name()).casefold() <
+             Glib::ustring(b->get_name()).casefold();
+    });
+
+    return apps.size();
+  });
+
+  std::vector<std::string> dirs = DesktopEntryTable::application_dirs();
+  bool same_ids = compare_ids(gio_ids(),
+                              table_ids(DesktopEntryTable::parse(dirs)));
+  std::cout << "Desktop file ids " << (same_ids ? "match" : "differ")
+            << " between Gio and DesktopEntryTable\n";
+
+  run("DesktopEntryTable::parse (cold)", [&]() {
+    return DesktopEntryTable::parse(dirs).size();
+  });
+
+  std::string snapshot = (root / "snapshot").string();
+  DesktopEntryTable::parse(dirs).save(snapshot);
+  run("DesktopEntryTable::load_snapshot (warm)", [&]() {
+    auto table = DesktopEntryTable::load_snapshot(snapshot);
+    return table ? table->size() : 0;
+  });
+
+  std::error_code error;
+  fs::permissions(data_dir / "applications" / "unreadable",
+                  fs::perms::owner_all, error);
+  fs::remove_all(root, error);
+
+  return same_ids ? 0 : 1;
+}
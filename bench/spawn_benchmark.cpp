@@ -0,0 +1,59 @@
+/* Compares how long starting a program takes from a process with a large
+ * resident set, as the overlay has once its caches are filled: through
+ * Glib::spawn_async, as the launcher used to, against SpawnHelper.
+ *
+ * Usage: spawn-benchmark [resident MiB] [program]
+ *
+ * The program is given by its full path, /bin/true by default, and must
+ * exit on its own. */
+
+#include "spawn_helper.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <giomm.h>
+#include <iostream>
+#include <memory>
+
+static constexpr size_t DEFAULT_RESIDENT_MIB = 1024;
+static constexpr size_t ITERATIONS = 50;
+
+template <typename F>
+static void run(const char *label, F spawn) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ITERATIONS; i++)
+    spawn();
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << label << ": " << seconds * 1e3 / ITERATIONS << " ms/spawn\n";
+}
+
+int main(int argc, char *argv[]) {
+  /* Forked while the process is still small, like in the overlay. */
+  SpawnHelper helper;
+
+  size_t resident_mib = argc > 1 ? std::stoul(argv[1]) : DEFAULT_RESIDENT_MIB;
+  std::vector<std::string> args = {argc > 2 ? argv[2] : "/bin/true"};
+
+  /* Many small allocations, to have as many mappings as pages to copy. */
+  std::vector<std::unique_ptr<char[]>> blocks;
+  for (size_t i = 0; i < resident_mib; i++) {
+    blocks.emplace_back(new char[1024 * 1024]);
+    memset(blocks.back().get(), i, 1024 * 1024);
+  }
+
+  std::cout << resident_mib << " MiB resident\n";
+
+  run("Glib::spawn_async", [&]() {
+    Glib::spawn_async("", args);
+  });
+
+  run("SpawnHelper::spawn", [&]() {
+    SpawnedProcess process = helper.spawn("", args);
+    if (process.pidfd != -1)
+      close(process.pidfd);
+  });
+
+  return 0;
+}
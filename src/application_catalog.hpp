@@ -0,0 +1,435 @@
+#pragma once
+
+#include "desktop_entry_table.hpp"
+#include "file_watcher.hpp"
+#include "fuzzy_matcher.hpp"
+#include "thread_role.hpp"
+#include "token_index.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/* Who would define C as 1? */
+#ifdef C
+#undef C
+#endif
+
+#include <tbb/concurrent_queue.h>
+
+/* Words an application can be found by: those of its name, and its search
+ * terms from GenericName, Keywords, Categories and the name of its
+ * executable. */
+static std::vector<std::string> application_tokens(std::string_view key,
+                                                   std::string_view terms) {
+  std::vector<std::string> tokens = split_tokens(key);
+  for (std::string &token : split_tokens(terms))
+    tokens.push_back(std::move(token));
+  return tokens;
+}
+
+/* Applications as they were when the table was built, shared by every
+ * snapshot until it is rebuilt. Token index documents are rows of the
+ * table. */
+struct ApplicationBase {
+  DesktopEntryTable table;
+  FuzzyMatcher matcher;
+  TokenIndex index;
+
+  ApplicationBase(DesktopEntryTable table): table(std::move(table)) {
+    const DesktopEntryTable &rows = this->table;
+
+    std::vector<std::string_view> keys;
+    keys.reserve(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) {
+      keys.push_back(rows.get(i, DesktopField::Key));
+      index.insert(i, application_tokens(rows.get(i, DesktopField::Key),
+                                         rows.get(i, DesktopField::Terms)));
+    }
+
+    matcher = FuzzyMatcher(keys);
+  }
+};
+
+/* Everything needed to show and search applications, replaced as a whole
+ * when they change.
+ *
+ * Rows below the size of the base are those of its table, and rows past it
+ * are the applications changed since the base was built, in the order of
+ * the table. Rows of the base whose application changed or was removed are
+ * hidden: they are never listed nor found, so that a snapshot only has to
+ * copy what changed. */
+struct ApplicationSnapshot {
+  std::shared_ptr<const ApplicationBase> base;
+
+  std::vector<DesktopEntry> changed;
+  FuzzyMatcher changed_matcher;
+  TokenIndex changed_index;
+
+  /* Rows of the base, sorted. */
+  std::vector<uint32_t> hidden;
+
+  /* Rows are numbered below this, including hidden ones. */
+  size_t size() const { return base->table.size() + changed.size(); }
+
+  std::string_view get(uint32_t row, DesktopField field) const {
+    size_t base_size = base->table.size();
+    if (row < base_size)
+      return base->table.get(row, field);
+    return changed[row - base_size].get(field);
+  }
+
+  /* Rows that are not hidden, in the order of the table. */
+  std::vector<uint32_t> rows() const {
+    auto before = [&](uint32_t a, uint32_t b) {
+      return std::pair(get(a, DesktopField::Key), get(a, DesktopField::Name)) <
+             std::pair(get(b, DesktopField::Key), get(b, DesktopField::Name));
+    };
+
+    std::vector<uint32_t> result;
+    result.reserve(size() - hidden.size());
+
+    uint32_t base_size = base->table.size(), next_changed = base_size;
+    auto next_hidden = hidden.begin();
+    for (uint32_t row = 0; row < base_size; row++) {
+      if (next_hidden != hidden.end() && *next_hidden == row) {
+        next_hidden++;
+        continue;
+      }
+
+      while (next_changed < size() && before(next_changed, row))
+        result.push_back(next_changed++);
+      result.push_back(row);
+    }
+
+    while (next_changed < size())
+      result.push_back(next_changed++);
+
+    return result;
+  }
+
+  /* Keeps the candidates that match the query, best first. */
+  std::vector<uint32_t> rank(std::string_view query,
+                             const std::vector<uint32_t> &candidates) const {
+    size_t base_size = base->table.size();
+    return FuzzyMatcher::rank(
+      query, candidates,
+      [&](uint32_t row, std::string_view query, uint64_t query_mask) {
+        if (row < base_size)
+          return base->matcher.score(row, query, query_mask);
+        return changed_matcher.score(row - base_size, query, query_mask);
+      });
+  }
+
+  /* Rows where every word of the query is the prefix of an indexed word,
+   * sorted. */
+  std::vector<uint32_t> lookup(std::string_view query) const {
+    std::vector<uint32_t> rows;
+    for (uint32_t row : base->index.lookup(query)) {
+      if (!std::binary_search(hidden.begin(), hidden.end(), row))
+        rows.push_back(row);
+    }
+
+    for (uint32_t document : changed_index.lookup(query))
+      rows.push_back(base->table.size() + document);
+
+    return rows;
+  }
+};
+
+/* Keeps the list of applications up to date while the overlay runs.
+ *
+ * The application directories are watched with inotify. Changed desktop
+ * files are parsed again on a background thread, one at a time, and the
+ * new snapshot shares the base of the previous one: only applications
+ * changed since the base was built are copied, sorted and indexed again.
+ * Once too many changed, a new base is built from all of them and saved to
+ * the cache for the next start; it is also saved when the catalog is
+ * destroyed. */
+class ApplicationCatalog {
+  /* Installing a package creates several files in a row; changes are
+   * applied once they have settled. */
+  static constexpr auto SETTLE_DELAY = std::chrono::milliseconds(250);
+
+  /* Changed applications a snapshot copies before the base is rebuilt. */
+  static constexpr size_t MAX_CHANGED = 256;
+
+  struct Change {
+    std::string dir, name;
+    auto operator<=>(const Change&) const = default;
+  };
+
+  std::atomic<std::shared_ptr<const ApplicationSnapshot>> current;
+
+  /* Only used by the update thread once the constructor is done. Rows of
+   * the base are indexed by desktop id when it is first updated. */
+  std::vector<std::string> roots;
+  DirStamps dir_stamps;
+  std::shared_ptr<const ApplicationBase> base;
+  std::unordered_map<std::string, uint32_t> base_rows;
+  bool has_base_rows = false;
+
+  /* Applications changed since the base was built, by desktop id, and the
+   * rows of the base they replace or remove. */
+  std::map<std::string, DesktopEntry> changed;
+  std::set<uint32_t> hidden;
+
+  /* Whether the cache is older than the current applications. */
+  bool unsaved = false;
+
+  /* Changed files, or nullopt to stop the thread. */
+  tbb::concurrent_bounded_queue<std::optional<Change>> changes;
+  std::jthread update_thread;
+
+  /* Destroyed first, so that no change is reported during destruction. */
+  FileWatcher watcher;
+
+public:
+  ApplicationCatalog():
+    roots(DesktopEntryTable::application_dirs()),
+    update_thread([this]() { update(); }),
+    watcher([this](const std::string &dir, const std::string &name) {
+      changes.push(Change{dir, name});
+    }) {
+    DesktopEntryTable table = DesktopEntryTable::load();
+    dir_stamps = table.dir_stamps();
+    base = std::make_shared<const ApplicationBase>(std::move(table));
+    publish();
+
+    for (const auto &[dir, mtime] : dir_stamps) {
+      if (mtime != -1)
+        watcher.watch(dir);
+    }
+  }
+
+  ~ApplicationCatalog() {
+    changes.push(std::nullopt);
+  }
+
+  std::shared_ptr<const ApplicationSnapshot> snapshot() const {
+    return current.load();
+  }
+
+private:
+  void update() {
+    set_thread_role(ThreadRole::Background, "app-catalog");
+
+    std::optional<Change> change;
+    while (true) {
+      changes.pop(change);
+      if (!change)
+        break;
+
+      std::this_thread::sleep_for(SETTLE_DELAY);
+
+      std::set<Change> pending{std::move(*change)};
+      while (changes.try_pop(change) && change)
+        pending.insert(std::move(*change));
+      if (!change)
+        break;
+
+      apply(pending);
+    }
+
+    if (unsaved)
+      rebase();
+  }
+
+  /* Directories are stamped right before they are read, so that a change
+   * made while reading them leaves the cache with an older modification
+   * time than the directory. */
+  void apply(const std::set<Change> &pending) {
+    if (!has_base_rows) {
+      for (size_t row = 0; row < base->table.size(); row++)
+        base_rows.emplace(base->table.get(row, DesktopField::Id), row);
+      has_base_rows = true;
+    }
+
+    /* Relative paths of the desktop files to look up again. */
+    std::set<std::string> dirty;
+
+    for (const Change &change : pending) {
+      /* Events were lost: every application directory is scanned again. */
+      if (change.dir.empty()) {
+        for (const std::string &root : roots)
+          directory_changed(root, dirty);
+        continue;
+      }
+
+      std::filesystem::path path = change.dir;
+      if (!change.name.empty()) {
+        stamp(change.dir);
+        path /= change.name;
+      }
+
+      std::error_code error;
+      if (change.name.empty() || std::filesystem::is_directory(path, error))
+        directory_changed(path, dirty);
+      else if (path.extension() == ".desktop") {
+        if (auto relative = relative_path(path))
+          dirty.insert(*relative);
+      }
+    }
+
+    unsaved = true;
+    if (dirty.empty())
+      return;
+
+    for (const std::string &relative : dirty)
+      resolve(relative);
+
+    if (changed.size() + hidden.size() > MAX_CHANGED)
+      rebase();
+
+    publish();
+  }
+
+  /* A directory was created, moved or deleted: every desktop file inside
+   * it, before or after the change, is looked up again. */
+  void directory_changed(const std::filesystem::path &dir,
+                         std::set<std::string> &dirty) {
+    std::string prefix = dir.string() + "/";
+    auto add_entry = [&](std::string_view path) {
+      if (path.starts_with(prefix)) {
+        if (auto relative = relative_path(path))
+          dirty.insert(*relative);
+      }
+    };
+
+    for (size_t row = 0; row < base->table.size(); row++)
+      add_entry(base->table.get(row, DesktopField::Path));
+    for (const auto &[id, entry] : changed)
+      add_entry(entry.get(DesktopField::Path));
+
+    std::error_code error;
+    if (!std::filesystem::is_directory(dir, error))
+      return;
+
+    add_directory(dir.string());
+    DesktopEntryTable::walk_directory(
+      dir,
+      [&](const std::filesystem::path &subdir) { add_directory(subdir); },
+      [&](const std::filesystem::path &path) {
+        if (path.extension() != ".desktop")
+          return;
+        if (auto relative = relative_path(path))
+          dirty.insert(*relative);
+      });
+  }
+
+  void add_directory(const std::string &dir) {
+    stamp(dir);
+    watcher.watch(dir);
+  }
+
+  void stamp(const std::string &dir) {
+    int64_t mtime = DesktopEntryTable::dir_mtime(dir);
+    auto it = std::find_if(dir_stamps.begin(), dir_stamps.end(),
+                           [&](const auto &stamp) {
+                             return stamp.first == dir;
+                           });
+    if (it != dir_stamps.end())
+      it->second = mtime;
+    else
+      dir_stamps.emplace_back(dir, mtime);
+  }
+
+  /* Path of a desktop file relative to the application directory it is
+   * in. */
+  std::optional<std::string> relative_path(
+    const std::filesystem::path &path) const {
+    for (const std::string &root : roots) {
+      std::string relative = path.lexically_relative(root);
+      if (!relative.empty() && !relative.starts_with(".."))
+        return relative;
+    }
+
+    return std::nullopt;
+  }
+
+  /* Finds which file now provides a desktop id, and updates its entry. The
+   * first application directory containing it hides the others, even if
+   * its entry is hidden. */
+  void resolve(const std::string &relative) {
+    std::string id = DesktopEntryTable::desktop_id(relative);
+
+    std::optional<DesktopEntry> entry;
+    for (const std::string &root : roots) {
+      std::filesystem::path path = std::filesystem::path(root) / relative;
+      std::error_code error;
+      if (std::filesystem::is_regular_file(path, error)) {
+        entry = DesktopEntryTable::parse_file(id, path);
+        break;
+      }
+    }
+
+    auto row = base_rows.find(id);
+    if (row != base_rows.end())
+      hidden.insert(row->second);
+
+    if (entry)
+      changed[id] = std::move(*entry);
+    else
+      changed.erase(id);
+  }
+
+  /* Builds a new base from every application, and saves it to the
+   * cache. */
+  void rebase() {
+    std::vector<DesktopEntry> entries;
+    entries.reserve(base->table.size() - hidden.size() + changed.size());
+    for (size_t row = 0; row < base->table.size(); row++) {
+      if (!hidden.count(row))
+        entries.push_back(base->table.entry(row));
+    }
+
+    for (const auto &[id, entry] : changed)
+      entries.push_back(entry);
+    std::sort(entries.begin(), entries.end());
+
+    DesktopEntryTable table =
+      DesktopEntryTable::build(entries, roots.size(), dir_stamps);
+    table.save(DesktopEntryTable::snapshot_path());
+    base = std::make_shared<const ApplicationBase>(std::move(table));
+
+    base_rows.clear();
+    has_base_rows = false;
+    changed.clear();
+    hidden.clear();
+    unsaved = false;
+  }
+
+  /* The base is shared with the previous snapshot: only changed
+   * applications are copied and indexed. */
+  void publish() {
+    auto snapshot = std::make_shared<ApplicationSnapshot>();
+    snapshot->base = base;
+
+    for (const auto &[id, entry] : changed)
+      snapshot->changed.push_back(entry);
+    std::sort(snapshot->changed.begin(), snapshot->changed.end());
+
+    std::vector<std::string_view> keys;
+    for (size_t i = 0; i < snapshot->changed.size(); i++) {
+      const DesktopEntry &entry = snapshot->changed[i];
+      keys.push_back(entry.get(DesktopField::Key));
+      snapshot->changed_index.insert(
+        i, application_tokens(entry.get(DesktopField::Key),
+                              entry.get(DesktopField::Terms)));
+    }
+
+    snapshot->changed_matcher = FuzzyMatcher(keys);
+    snapshot->hidden.assign(hidden.begin(), hidden.end());
+    current.store(std::move(snapshot));
+  }
+};
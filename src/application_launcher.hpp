@@ -1,64 +1,153 @@
 #pragma once
 
+#include "application_catalog.hpp"
 #include "gl_texture.hpp"
+#include "frecency_store.hpp"
 #include "icon_fetcher.hpp"
+#include "launch_queue.hpp"
 #include "gamescope_parameters.hpp"
+#include "search_key.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <giomm.h>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
-struct Application {
-  Glib::RefPtr<Gio::AppInfo> app;
+class ApplicationLauncher {
+  /* Applications shown in the recent row, and whose icons are loaded while
+   * the dashboard is hidden. */
+  static constexpr size_t RECENT_COUNT = 5;
+
+  /* How long the outcome of a launch stays on its tile. */
+  static constexpr auto STATUS_DURATION = std::chrono::seconds(10);
+  static constexpr auto START_TIMEOUT = std::chrono::seconds(60);
+
+  ApplicationCatalog catalog;
+  std::shared_ptr<const ApplicationSnapshot> applications;
+  FrecencyStore frecency;
+  LaunchQueue &launches;
+  char search[2048];
+  bool use_gamescope;
+  bool show_recent;
 
-  Application(const Glib::RefPtr<Gio::AppInfo> &app): app(app)
-    {}
+  /* Applications by decreasing frecency, then alphabetically, and the
+   * position of each application in that order. */
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> rank_of;
+  size_t recent_count = 0;
 
-  bool matches(const Glib::ustring &search) const {
-    return Glib::ustring(app->get_name()).lowercase().find(search) !=
-      Glib::ustring::npos;
+  float last_icon_size = 0;
+
+  /* Latest launch of each application, by row. Only updated when the
+   * launches or the rows change. */
+  std::unordered_map<uint32_t, LaunchStatus> launch_statuses;
+  std::optional<uint64_t> launch_generation;
+
+  /* Results for each query leading to the current one, best match first.
+   * Every entry narrows the previous one: an application matching a query
+   * also matches any prefix of it, so typing a character only ranks the last
+   * result again, and erasing one goes back to an earlier entry. */
+  struct FilterResult {
+    std::string key;
+    std::vector<uint32_t> apps;
+  };
+
+  std::string last_search;
+  std::vector<FilterResult> filter_history;
+
+public:
+  ApplicationLauncher(LaunchQueue &launches):
+    applications(catalog.snapshot()),
+    launches(launches),
+    search(""), use_gamescope(true), show_recent(true) {
+    update_order();
   }
 
-  std::optional<GLTexture*> icon(IconFetcher &fetcher) const {
-    return fetcher.fetch_texture(app->get_icon());
+  /* Switches to the latest list of applications, if it changed. Results
+   * are computed again since every row may have moved. */
+  void refresh() {
+    auto latest = catalog.snapshot();
+    if (latest == applications)
+      return;
+
+    applications = std::move(latest);
+    update_order();
+    launch_generation.reset();
   }
-};
 
-class ApplicationLauncher {
-  std::vector<Application> applications;
-  char search[2048];
-  bool use_gamescope;
-public:
-  ApplicationLauncher(): use_gamescope(true) {
-    for (auto &&app : Gio::AppInfo::get_all()) {
-      if (!app->should_show())
-        continue;
+  /* Cached until the search string changes. */
+  const std::vector<uint32_t> &selected_applications() {
+    if (!filter_history.empty() && last_search == search)
+      return filter_history.back().apps;
+
+    last_search = search;
+    std::string key = search_key(search);
+    while (!filter_history.empty() &&
+           !key.starts_with(filter_history.back().key))
+      filter_history.pop_back();
+
+    if (!filter_history.empty() && filter_history.back().key == key)
+      return filter_history.back().apps;
+
+    /* Candidates are kept in order of frecency, which breaks ties between
+     * equal scores. */
+    std::vector<uint32_t> candidates;
+    if (filter_history.empty())
+      candidates = order;
+    else {
+      candidates = filter_history.back().apps;
+      sort_by_rank(candidates);
+    }
 
-      applications.emplace_back(app);
+    FilterResult result{key, applications->rank(key, candidates)};
+    std::vector<uint32_t> ranked = result.apps;
+
+    /* Applications found only through their keywords come after those
+     * matching by name. */
+    std::vector<uint32_t> found = applications->lookup(key), keyword_only;
+    if (!filter_history.empty()) {
+      std::sort(candidates.begin(), candidates.end());
+      std::vector<uint32_t> narrowed;
+      std::set_intersection(found.begin(), found.end(),
+                            candidates.begin(), candidates.end(),
+                            std::back_inserter(narrowed));
+      found = std::move(narrowed);
     }
 
-    std::sort(applications.begin(), applications.end(),
-              [](const auto &a, const auto &b) {
-                const Glib::ustring name_a =
-                    Glib::ustring(a.app->get_name()).casefold();
-                const Glib::ustring name_b =
-                    Glib::ustring(b.app->get_name()).casefold();
+    std::sort(ranked.begin(), ranked.end());
+    std::set_difference(found.begin(), found.end(),
+                        ranked.begin(), ranked.end(),
+                        std::back_inserter(keyword_only));
+    sort_by_rank(keyword_only);
+    result.apps.insert(result.apps.end(), keyword_only.begin(),
+                       keyword_only.end());
 
-                return name_a.compare(name_b) < 0;
-              });
+    filter_history.push_back(std::move(result));
+    return filter_history.back().apps;
   }
 
-  std::vector<const Application*> selected_applications() const {
-    Glib::ustring search_string(search);
-    std::vector<const Application*> selected_apps;
-    for (auto &app : applications) {
-      if (app.matches(search_string))
-        selected_apps.push_back(&app);
-    }
+  /* Loads the icons of the most likely applications, so that they are
+   * ready when the dashboard is opened. Called every frame while it is
+   * hidden, which also keeps them from being trimmed. */
+  void prefetch_icons(IconFetcher &icons) {
+    refresh();
+    if (last_icon_size == 0)
+      return;
 
-    return selected_apps;
+    for (size_t i = 0; i < RECENT_COUNT && i < order.size(); i++)
+      icon(order[i], icons, last_icon_size);
   }
 
   void draw(IconFetcher &icons, GamescopeParameters &gamescope_params) {
+    refresh();
+    update_launch_statuses();
+
     if (ImGui::BeginTable("launcher_table", 2)) {
       ImGui::TableSetupColumn("applications",
                               ImGuiTableColumnFlags_WidthStretch, 1.0);
@@ -72,72 +161,211 @@ public:
 
       ImGui::InputText("Search", search, sizeof(search));
 
-      Glib::ustring search_string(search);
-      std::vector<Application *> selected_apps;
-      for (auto &app : applications) {
-        if (app.matches(search_string))
-          selected_apps.push_back(&app);
+      std::optional<uint32_t> launched;
+
+      if (show_recent && search[0] == '\0' && recent_count != 0) {
+        ImGui::TextUnformatted("Recent");
+        if (ImGui::BeginTable("recent_applications", 5)) {
+          ImGui::TableNextRow();
+          for (size_t i = 0; i < recent_count; i++) {
+            ImGui::TableNextColumn();
+            if (draw_application(order[i], icons))
+              launched = order[i];
+          }
+          ImGui::EndTable();
+        }
+        ImGui::Separator();
       }
 
       if (ImGui::BeginTable("applications", 5, ImGuiTableFlags_ScrollY)) {
         ImGui::TableNextRow();
-        for (Application *app : selected_apps) {
+        for (uint32_t id : selected_applications()) {
           ImGui::TableNextColumn();
-
-          float width = ImGui::GetContentRegionAvail().x;
-          width -= ImGui::GetStyle().FramePadding.x * 2.0;
-
-          ImVec2 button_size(width, width);
-
-          auto icon = app->icon(icons);
-          bool clicked = false;
-          if (icon) {
-            ImGui::BeginGroup();
-            width -= ImGui::GetTextLineHeightWithSpacing();
-            if (icon.value()->draw_button(ImVec2(width, width)))
-              clicked = true;
-            ImGui::TextUnformatted(app->app->get_name().c_str());
-
-            ImGui::EndGroup();
-          } else {
-            if (ImGui::Button(app->app->get_name().c_str(), button_size))
-              clicked = true;
-          }
-
-          if (clicked) {
-            if (use_gamescope) {
-              auto ms = std::chrono::system_clock::now().time_since_epoch() /
-                        std::chrono::milliseconds(1);
-              std::stringstream stream;
-              stream.imbue(std::locale("C"));
-              stream << "gamescope -w " << gamescope_params.width << " -h "
-                     << gamescope_params.height << " --openvr"
-                     << " --vr-overlay-physical-width "
-                     << gamescope_params.physical_width
-                     << " --vr-overlay-enable-control-bar"
-                     << " --vr-overlay-enable-control-bar-keyboard"
-                     << " --vr-overlay-enable-control-bar-close"
-                     << " --vr-overlay-key launcher-openvr-overlay-" << ms
-                     << " " << gamescope_params.extra_options << " -- "
-                     << app->app->get_commandline();
-
-              auto wrapped_app = Gio::AppInfo::create_from_commandline(
-                  stream.str(), app->app->get_name() + " [openvr]",
-                  Gio::AppInfo::CreateFlags::NONE);
-              wrapped_app->launch(nullptr, nullptr);
-            } else
-              app->app->launch(nullptr, nullptr);
-          }
+          if (draw_application(id, icons))
+            launched = id;
         }
         ImGui::EndTable();
       }
       ImGui::EndGroup();
 
+      /* Launching reorders the applications, which cannot be done while
+       * iterating over them. */
+      if (launched)
+        launch(*launched, gamescope_params);
+
       ImGui::TableNextColumn();
       ImGui::Checkbox("Run as VR Overlay", &use_gamescope);
+      ImGui::Checkbox("Show Recent Applications", &show_recent);
       ImGui::Separator();
       gamescope_params.draw();
       ImGui::EndTable();
     }
   }
+
+private:
+  void update_order() {
+    order = applications->rows();
+
+    std::vector<double> scores(applications->size());
+    for (uint32_t i : order)
+      scores[i] = frecency.score(
+        std::string(applications->get(i, DesktopField::Id)));
+
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return scores[a] > scores[b];
+    });
+
+    rank_of.resize(applications->size());
+    for (size_t i = 0; i < order.size(); i++)
+      rank_of[order[i]] = i;
+
+    recent_count = 0;
+    while (recent_count < std::min(RECENT_COUNT, order.size()) &&
+           scores[order[recent_count]] > 0)
+      recent_count++;
+
+    filter_history.clear();
+  }
+
+  std::optional<GLTexture*> icon(uint32_t id, IconFetcher &icons,
+                                 float size) const {
+    std::string_view name = applications->get(id, DesktopField::Icon);
+    if (name.empty())
+      return std::nullopt;
+    return icons.fetch_texture(std::string(name), size);
+  }
+
+  void sort_by_rank(std::vector<uint32_t> &ids) const {
+    std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) {
+      return rank_of[a] < rank_of[b];
+    });
+  }
+
+  /* Returns true when the application is clicked. */
+  bool draw_application(uint32_t id, IconFetcher &icons) {
+    const char *name = applications->get(id, DesktopField::Name).data();
+
+    float width = ImGui::GetContentRegionAvail().x;
+    width -= ImGui::GetStyle().FramePadding.x * 2.0;
+
+    ImVec2 button_size(width, width);
+    float icon_width = width - ImGui::GetTextLineHeightWithSpacing();
+    last_icon_size = icon_width;
+
+    auto icon = this->icon(id, icons, icon_width);
+    bool clicked = false;
+    if (icon) {
+      ImGui::BeginGroup();
+      if (icon.value()->draw_button(ImVec2(icon_width, icon_width)))
+        clicked = true;
+      ImGui::TextUnformatted(name);
+
+      ImGui::EndGroup();
+    } else {
+      if (ImGui::Button(name, button_size))
+        clicked = true;
+    }
+
+    if (ImGui::IsItemHovered())
+      warm(id);
+
+    draw_launch_status(id);
+    return clicked;
+  }
+
+  /* Programs the application would start are read ahead while it is
+   * hovered. */
+  void warm(uint32_t id) {
+    if (use_gamescope)
+      launches.warm("gamescope");
+
+    std::string_view exec = applications->get(id, DesktopField::Exec);
+    if (!exec.empty())
+      launches.warm(DesktopEntryTable::executable(exec));
+  }
+
+  void update_launch_statuses() {
+    uint64_t generation = launches.generation();
+    if (launch_generation == generation)
+      return;
+    launch_generation = generation;
+
+    std::unordered_map<std::string_view, const LaunchStatus*> by_key;
+    std::vector<LaunchStatus> statuses = launches.recent();
+    for (const LaunchStatus &status : statuses)
+      by_key[status.key] = &status;
+
+    launch_statuses.clear();
+    for (uint32_t row : order) {
+      auto it = by_key.find(applications->get(row, DesktopField::Id));
+      if (it != by_key.end())
+        launch_statuses.emplace(row, *it->second);
+    }
+  }
+
+  void draw_launch_status(uint32_t id) {
+    auto it = launch_statuses.find(id);
+    if (it == launch_statuses.end())
+      return;
+
+    const LaunchStatus &status = it->second;
+    auto now = LaunchStatus::Clock::now();
+    switch (status.state) {
+    case LaunchState::Queued:
+    case LaunchState::Spawned:
+      if (now - status.queued < START_TIMEOUT)
+        ImGui::TextDisabled("Starting...");
+      break;
+
+    case LaunchState::Ready:
+      if (now - status.ready < STATUS_DURATION)
+        ImGui::TextDisabled("Started in %.1f s", status.ready_ms() / 1000);
+      break;
+
+    case LaunchState::Failed:
+      if (now - status.spawned < STATUS_DURATION) {
+        ImGui::TextColored(ImVec4(1, 0.4, 0.4, 1), "Failed to start");
+        if (ImGui::IsItemHovered())
+          ImGui::SetTooltip("%s", status.error.c_str());
+      }
+      break;
+    }
+  }
+
+  void launch(uint32_t id, GamescopeParameters &gamescope_params) {
+    std::string name(applications->get(id, DesktopField::Name));
+    std::string desktop_id(applications->get(id, DesktopField::Id));
+
+    /* Applications without an Exec line can only be activated through
+     * D-Bus, outside of gamescope. */
+    std::string_view exec = applications->get(id, DesktopField::Exec);
+
+    LaunchCommand command;
+    if (use_gamescope && !exec.empty()) {
+      auto ms = std::chrono::system_clock::now().time_since_epoch() /
+                std::chrono::milliseconds(1);
+      std::stringstream stream;
+      stream.imbue(std::locale("C"));
+      stream << "gamescope -w " << gamescope_params.width << " -h "
+             << gamescope_params.height << " --openvr"
+             << " --vr-overlay-physical-width "
+             << gamescope_params.physical_width
+             << " --vr-overlay-enable-control-bar"
+             << " --vr-overlay-enable-control-bar-keyboard"
+             << " --vr-overlay-enable-control-bar-close"
+             << " --vr-overlay-key launcher-openvr-overlay-" << ms
+             << " " << gamescope_params.extra_options << " -- " << exec;
+
+      command.command_line = stream.str();
+      command.overlay_key = "launcher-openvr-overlay-" + std::to_string(ms);
+      name += " [openvr]";
+    }
+    else
+      command.desktop_file = applications->get(id, DesktopField::Path);
+
+    launches.launch(desktop_id, std::move(name), std::move(command));
+
+    frecency.record_launch(desktop_id);
+    update_order();
+  }
 };
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "frame_scheduler.hpp"
+#include "icon_fetcher.hpp"
+#include "idle_trimmer.hpp"
+#include "launch_queue.hpp"
+#include "memory_ledger.hpp"
+#include "memory_pressure.hpp"
+#include "window_monitor.hpp"
+
+#include <imgui.h>
+
+class DebugPanel {
+public:
+  void draw(IconFetcher &icons, WindowMonitor &window_monitor,
+            FrameScheduler &scheduler, const IdleTrimmer &idle_trimmer,
+            const MemoryPressureMonitor &memory_pressure,
+            const LaunchQueue &launches) {
+    if (ImGui::CollapsingHeader("Memory", ImGuiTreeNodeFlags_DefaultOpen)) {
+      ImGui::Text("Resident set: %.1f MiB", to_mib(resident_memory()));
+
+      if (ImGui::BeginTable("memory_ledger", 3)) {
+        ImGui::TableSetupColumn("Cache", ImGuiTableColumnFlags_WidthStretch,
+                                1.0);
+        ImGui::TableSetupColumn("Objects", ImGuiTableColumnFlags_WidthFixed,
+                                200);
+        ImGui::TableSetupColumn("Size", ImGuiTableColumnFlags_WidthFixed,
+                                300);
+        ImGui::TableHeadersRow();
+
+        int64_t total = 0;
+        for (size_t i = 0; i < (size_t)MemoryCategory::Count; i++) {
+          auto &account = MemoryLedger::get((MemoryCategory)i);
+          int64_t bytes = account.bytes.load(std::memory_order_relaxed);
+          total += bytes;
+
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(MEMORY_CATEGORY_NAMES[i]);
+          ImGui::TableNextColumn();
+          ImGui::Text("%lld", (long long)account.count.load(
+                        std::memory_order_relaxed));
+          ImGui::TableNextColumn();
+          ImGui::Text("%.2f MiB", to_mib(bytes));
+        }
+
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted("Total");
+        ImGui::TableNextColumn();
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f MiB", to_mib(total));
+
+        ImGui::EndTable();
+      }
+
+      if (ImGui::Button("Reload Textures")) {
+        icons.drop_textures();
+        window_monitor.drop_textures();
+      }
+
+      IdleTrimStats trim_stats = idle_trimmer.get_stats();
+      ImGui::Text("Trimmed while hidden: %llu times, last freed %.1f MiB",
+                  (unsigned long long)trim_stats.trims,
+                  to_mib(trim_stats.last_freed_bytes));
+    }
+
+    if (ImGui::CollapsingHeader("Texture Cache",
+                                ImGuiTreeNodeFlags_DefaultOpen)) {
+      int budget_mib = icons.get_texture_budget() / (1024 * 1024);
+      if (ImGui::SliderInt("Budget [MiB]", &budget_mib, 16, 2048))
+        icons.set_texture_budget((size_t)budget_mib * 1024 * 1024);
+
+      ImGui::Text("Effective budget: %.0f MiB",
+                  to_mib(icons.effective_texture_budget()));
+
+      TextureCacheStats stats = icons.get_stats();
+      ImGui::Text("Hits: %llu", (unsigned long long)stats.hits);
+      ImGui::Text("Misses: %llu", (unsigned long long)stats.misses);
+      ImGui::Text("Evictions: %llu", (unsigned long long)stats.evictions);
+    }
+
+    if (ImGui::CollapsingHeader("Frame Scheduler",
+                                ImGuiTreeNodeFlags_DefaultOpen)) {
+      int budget_us = scheduler.get_budget_us();
+      if (ImGui::SliderInt("Budget [us]", &budget_us, 250, 10000))
+        scheduler.set_budget_us(budget_us);
+
+      FrameSchedulerStats stats = scheduler.get_stats();
+      ImGui::Text("Last frame: %lld us (max %lld us)",
+                  (long long)stats.last_frame_us,
+                  (long long)stats.max_frame_us);
+      ImGui::Text("Over budget: %llu of %llu frames",
+                  (unsigned long long)stats.overruns,
+                  (unsigned long long)stats.frames);
+      ImGui::Text("Jobs run: %llu, pending: %zu",
+                  (unsigned long long)stats.jobs_run, stats.pending);
+    }
+
+    if (ImGui::CollapsingHeader("Memory Pressure",
+                                ImGuiTreeNodeFlags_DefaultOpen)) {
+      ImGui::Text("Level: %s (some %.2f%%, full %.2f%%)",
+                  MEMORY_PRESSURE_NAMES[(int)memory_pressure.current_level()],
+                  memory_pressure.some_stall(), memory_pressure.full_stall());
+
+      auto now = std::chrono::steady_clock::now();
+      for (const auto &action : memory_pressure.recent_actions()) {
+        auto age = std::chrono::duration_cast<std::chrono::seconds>(
+          now - action.time).count();
+        ImGui::Text("%llds ago: %s", (long long)age,
+                    action.description.c_str());
+      }
+    }
+
+    if (ImGui::CollapsingHeader("Launches")) {
+      if (ImGui::BeginTable("launches", 5)) {
+        ImGui::TableSetupColumn("Application",
+                                ImGuiTableColumnFlags_WidthStretch, 1.0);
+        ImGui::TableSetupColumn("State", ImGuiTableColumnFlags_WidthFixed,
+                                150);
+        ImGui::TableSetupColumn("Spawn", ImGuiTableColumnFlags_WidthFixed,
+                                150);
+        ImGui::TableSetupColumn("Ready", ImGuiTableColumnFlags_WidthFixed,
+                                150);
+        ImGui::TableSetupColumn("Error", ImGuiTableColumnFlags_WidthStretch,
+                                1.0);
+        ImGui::TableHeadersRow();
+
+        std::vector<LaunchStatus> statuses = launches.recent();
+        for (auto it = statuses.rbegin(); it != statuses.rend(); ++it) {
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(it->label.c_str());
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(LAUNCH_STATE_NAMES[(int)it->state]);
+          ImGui::TableNextColumn();
+          if (it->state != LaunchState::Queued)
+            ImGui::Text("%.1f ms", it->spawn_ms());
+          ImGui::TableNextColumn();
+          if (it->state == LaunchState::Ready)
+            ImGui::Text("%.0f ms", it->ready_ms());
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(it->error.c_str());
+        }
+
+        ImGui::EndTable();
+      }
+    }
+  }
+};
@@ -0,0 +1,690 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include "search_key.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <giomm.h>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Who would define C as 1? */
+#ifdef C
+#undef C
+#endif
+
+#include <tbb/parallel_for.h>
+
+enum class DesktopField : uint32_t {
+  Id,    /* Desktop file id, e.g. org.mozilla.firefox.desktop */
+  Path,  /* Absolute path of the desktop file */
+  Name,  /* Localized name */
+  Key,   /* search_key of the name, which the table is sorted by */
+  Terms, /* search_key of GenericName, Keywords, Categories and executable */
+  Exec,
+  Icon,  /* Icon name, or absolute path */
+  Count,
+};
+
+/* A parsed desktop file, with the fields kept in DesktopEntryTable. */
+struct DesktopEntry {
+  std::string fields[(size_t)DesktopField::Count];
+
+  const std::string &get(DesktopField field) const {
+    return fields[(size_t)field];
+  }
+
+  /* Order of the table. */
+  bool operator<(const DesktopEntry &other) const {
+    constexpr size_t key = (size_t)DesktopField::Key;
+    constexpr size_t name = (size_t)DesktopField::Name;
+    return std::tie(fields[key], fields[name]) <
+           std::tie(other.fields[key], other.fields[name]);
+  }
+};
+
+/* Modification times of the directories a table was read from, or -1 for
+ * those that do not exist. */
+using DirStamps = std::vector<std::pair<std::string, int64_t>>;
+
+/* Applications shown in the launcher, read from the desktop files of the XDG
+ * application directories.
+ *
+ * The table is a set of columns of references into a single string pool,
+ * sorted by search key. It uses the same layout in memory as in the snapshot
+ * saved to the cache, so a warm start maps the snapshot and uses it in
+ * place, without parsing any desktop file. The snapshot is only used when
+ * every application directory still has the modification time it had when
+ * the snapshot was written, and when the language and the desktop
+ * environment have not changed.
+ *
+ * Otherwise, desktop files are parsed in parallel. Only what the launcher
+ * needs is kept: applications are still launched through Gio, from the path
+ * of their desktop file. */
+class DesktopEntryTable {
+  static constexpr char MAGIC[8] = {'L', 'O', 'O', 'D', 'E', 'S', 'K', '2'};
+  static constexpr size_t FIELD_COUNT = (size_t)DesktopField::Count;
+
+  struct StringRef {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t entry_count;
+    uint32_t dir_count;
+    uint32_t root_count;
+    StringRef environment;
+    uint32_t strings_size;
+  };
+
+  /* Directories are listed with their modification time, or -1 if they do
+   * not exist. The first root_count entries are the roots, in order. */
+  struct DirStamp {
+    StringRef path;
+    int64_t mtime;
+  };
+
+  std::vector<uint8_t> owned;
+  std::unique_ptr<MappedFile> mapped;
+
+  const Header *header = nullptr;
+  const DirStamp *dirs = nullptr;
+  const StringRef *cells = nullptr;
+  const char *strings = nullptr;
+
+public:
+  DesktopEntryTable() = default;
+
+  /* Uses the snapshot from the cache if it is still valid, and parses the
+   * desktop files otherwise, saving a new snapshot. */
+  static DesktopEntryTable load() {
+    std::string path = snapshot_path();
+    if (auto table = load_snapshot(path))
+      return std::move(*table);
+
+    DesktopEntryTable table = parse(application_dirs());
+    table.save(path);
+    return table;
+  }
+
+  static DesktopEntryTable parse(const std::vector<std::string> &roots) {
+    std::vector<std::string> languages = language_names();
+    std::vector<std::string> desktops = current_desktops();
+
+    DirStamps dir_stamps;
+    std::vector<std::pair<std::string, std::string>> files;
+    find_desktop_files(roots, dir_stamps, files);
+
+    std::vector<std::optional<DesktopEntry>> parsed(files.size());
+    tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, files.size(), 16),
+      [&](const tbb::blocked_range<size_t> &range) {
+        for (size_t i = range.begin(); i < range.end(); i++) {
+          parsed[i] = parse_desktop_file(files[i].first, files[i].second,
+                                         languages, desktops);
+        }
+      });
+
+    std::vector<DesktopEntry> entries;
+    for (auto &entry : parsed) {
+      if (entry)
+        entries.push_back(std::move(*entry));
+    }
+
+    std::sort(entries.begin(), entries.end());
+    return build(entries, roots.size(), dir_stamps);
+  }
+
+  /* Builds a table from entries that are already sorted. The first
+   * root_count directories must be the roots, in order. */
+  static DesktopEntryTable build(const std::vector<DesktopEntry> &entries,
+                                 size_t root_count,
+                                 const DirStamps &dir_stamps) {
+    DesktopEntryTable table;
+    table.owned = serialize(entries, root_count, dir_stamps,
+                            environment(language_names(),
+                                        current_desktops()));
+    table.set_data(table.owned.data(), table.owned.size());
+    return table;
+  }
+
+  /* Parses a single desktop file, returning nullopt if it should not be
+   * shown. */
+  static std::optional<DesktopEntry> parse_file(const std::string &id,
+                                                const std::string &path) {
+    return parse_desktop_file(id, path, language_names(), current_desktops());
+  }
+
+  size_t size() const { return header ? header->entry_count : 0; }
+
+  bool from_snapshot() const { return mapped != nullptr; }
+
+  /* Size of the table in memory, or mapped from the snapshot. */
+  size_t memory_size() const {
+    return mapped ? mapped->data().size() : owned.size();
+  }
+
+  /* Strings are followed by a null character. */
+  std::string_view get(size_t id, DesktopField field) const {
+    return string(cells[(size_t)field * size() + id]);
+  }
+
+  DesktopEntry entry(size_t id) const {
+    DesktopEntry result;
+    for (size_t field = 0; field < FIELD_COUNT; field++)
+      result.fields[field] = get(id, (DesktopField)field);
+    return result;
+  }
+
+  DirStamps dir_stamps() const {
+    DirStamps result;
+    for (size_t i = 0; i < (header ? header->dir_count : 0); i++)
+      result.emplace_back(string(dirs[i].path), dirs[i].mtime);
+    return result;
+  }
+
+  void save(const std::string &path) const {
+    std::error_code error;
+    std::filesystem::create_directories(
+      std::filesystem::path(path).parent_path(), error);
+
+    std::span<const uint8_t> data = bytes();
+    std::string tmp_path = path + ".tmp";
+    {
+      std::ofstream out(tmp_path, std::ios::binary);
+      out.write((const char*)data.data(), data.size());
+      if (!out) {
+        out.close();
+        std::remove(tmp_path.c_str());
+        return;
+      }
+    }
+
+    std::filesystem::rename(tmp_path, path, error);
+  }
+
+  static std::vector<std::string> application_dirs() {
+    std::vector<std::string> dirs = {
+      Glib::build_filename(Glib::get_user_data_dir(), "applications"),
+    };
+
+    for (const auto &data_dir : Glib::get_system_data_dirs())
+      dirs.push_back(Glib::build_filename(data_dir, "applications"));
+
+    return dirs;
+  }
+
+  static std::string snapshot_path() {
+    return Glib::build_filename(
+      Glib::get_user_cache_dir(),
+      Glib::build_filename("launcher-openvr-overlay", "applications"));
+  }
+
+  static std::optional<DesktopEntryTable> load_snapshot(
+    const std::string &path) {
+    auto file = std::make_unique<MappedFile>(path);
+    if (!*file)
+      return std::nullopt;
+
+    DesktopEntryTable table;
+    auto data = file->data();
+    if (!table.set_data(data.data(), data.size()))
+      return std::nullopt;
+
+    std::vector<std::string> roots = application_dirs();
+    if (table.header->root_count != roots.size() ||
+        table.string(table.header->environment) !=
+          environment(language_names(), current_desktops()))
+      return std::nullopt;
+
+    for (size_t i = 0; i < table.header->dir_count; i++) {
+      const DirStamp &dir = table.dirs[i];
+      std::string dir_path(table.string(dir.path));
+      if ((i < roots.size() && dir_path != roots[i]) ||
+          dir.mtime != dir_mtime(dir_path))
+        return std::nullopt;
+    }
+
+    table.mapped = std::move(file);
+    return table;
+  }
+
+private:
+  std::span<const uint8_t> bytes() const {
+    return mapped ? mapped->data() : std::span<const uint8_t>(owned);
+  }
+
+  std::string_view string(StringRef ref) const {
+    return std::string_view(strings + ref.offset, ref.size);
+  }
+
+  /* Points the table at its data, checking that it is consistent. */
+  bool set_data(const uint8_t *data, size_t size) {
+    if (size < sizeof(Header))
+      return false;
+
+    auto new_header = (const Header*)data;
+    if (memcmp(new_header->magic, MAGIC, sizeof(MAGIC)) != 0)
+      return false;
+
+    size_t dirs_offset = sizeof(Header);
+    size_t cells_offset = dirs_offset +
+      new_header->dir_count * sizeof(DirStamp);
+    size_t strings_offset = cells_offset +
+      new_header->entry_count * FIELD_COUNT * sizeof(StringRef);
+    if (new_header->root_count > new_header->dir_count ||
+        strings_offset + new_header->strings_size != size)
+      return false;
+
+    auto new_dirs = (const DirStamp*)(data + dirs_offset);
+    auto new_cells = (const StringRef*)(data + cells_offset);
+
+    auto valid = [&](StringRef ref) {
+      return (uint64_t)ref.offset + ref.size < new_header->strings_size &&
+        data[strings_offset + ref.offset + ref.size] == '\0';
+    };
+
+    bool ok = valid(new_header->environment);
+    for (size_t i = 0; i < new_header->dir_count; i++)
+      ok = ok && valid(new_dirs[i].path);
+    for (size_t i = 0; i < new_header->entry_count * FIELD_COUNT; i++)
+      ok = ok && valid(new_cells[i]);
+    if (!ok)
+      return false;
+
+    header = new_header;
+    dirs = new_dirs;
+    cells = new_cells;
+    strings = (const char*)data + strings_offset;
+    return true;
+  }
+
+  static std::vector<uint8_t> serialize(
+    const std::vector<DesktopEntry> &entries, size_t root_count,
+    const DirStamps &dir_stamps, const std::string &environment) {
+    std::string pool;
+    auto add_string = [&](std::string_view str) {
+      StringRef ref{(uint32_t)pool.size(), (uint32_t)str.size()};
+      pool.append(str);
+      pool.push_back('\0');
+      return ref;
+    };
+
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.entry_count = entries.size();
+    header.dir_count = dir_stamps.size();
+    header.root_count = root_count;
+    header.environment = add_string(environment);
+
+    std::vector<DirStamp> dirs;
+    for (const auto &[path, mtime] : dir_stamps)
+      dirs.push_back(DirStamp{add_string(path), mtime});
+
+    std::vector<StringRef> cells(entries.size() * FIELD_COUNT);
+    for (size_t field = 0; field < FIELD_COUNT; field++) {
+      StringRef *column = cells.data() + field * entries.size();
+      for (size_t i = 0; i < entries.size(); i++)
+        column[i] = add_string(entries[i].fields[field]);
+    }
+
+    header.strings_size = pool.size();
+
+    std::vector<uint8_t> data(sizeof(Header) +
+                              dirs.size() * sizeof(DirStamp) +
+                              cells.size() * sizeof(StringRef) +
+                              pool.size());
+    uint8_t *ptr = data.data();
+    auto append = [&](const void *src, size_t size) {
+      if (size != 0) memcpy(ptr, src, size);
+      ptr += size;
+    };
+
+    append(&header, sizeof(header));
+    append(dirs.data(), dirs.size() * sizeof(DirStamp));
+    append(cells.data(), cells.size() * sizeof(StringRef));
+    append(pool.data(), pool.size());
+
+    return data;
+  }
+
+public:
+  static int64_t dir_mtime(const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+      return -1;
+    return st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+  }
+
+  /* Id of the desktop file at a path relative to an application
+   * directory. */
+  static std::string desktop_id(const std::filesystem::path &relative_path) {
+    std::string id = relative_path;
+    std::replace(id.begin(), id.end(), '/', '-');
+    return id;
+  }
+
+  /* Visits every directory and file below root, each directory before its
+   * contents. Like Gio, symbolic links to directories are followed, and
+   * directories that cannot be read are skipped without stopping the
+   * walk. A link to one of its own parents is not followed again. */
+  template <typename OnDirectory, typename OnFile>
+  static void walk_directory(const std::filesystem::path &root,
+                             OnDirectory on_directory, OnFile on_file) {
+    std::set<std::pair<dev_t, ino_t>> parents;
+    struct stat st;
+    if (stat(root.c_str(), &st) == 0)
+      parents.emplace(st.st_dev, st.st_ino);
+
+    walk_directory(root, parents, on_directory, on_file);
+  }
+
+  /* First word of the command line, without quotes. */
+  static std::string executable(std::string_view exec) {
+    exec.remove_prefix(std::min(exec.find_first_not_of(' '), exec.size()));
+    if (!exec.empty() && exec[0] == '"') {
+      exec.remove_prefix(1);
+      return std::string(exec.substr(0, exec.find('"')));
+    }
+    return std::string(exec.substr(0, exec.find(' ')));
+  }
+
+private:
+  template <typename OnDirectory, typename OnFile>
+  static void walk_directory(const std::filesystem::path &dir,
+                             std::set<std::pair<dev_t, ino_t>> &parents,
+                             OnDirectory &on_directory, OnFile &on_file) {
+    std::error_code error;
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto it = std::filesystem::directory_iterator(dir, options, error);
+         !error && it != std::filesystem::directory_iterator();
+         it.increment(error)) {
+      const std::filesystem::path &path = it->path();
+
+      std::error_code type_error;
+      if (!it->is_directory(type_error)) {
+        on_file(path);
+        continue;
+      }
+
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0)
+        continue;
+
+      auto [parent, inserted] = parents.emplace(st.st_dev, st.st_ino);
+      if (!inserted)
+        continue;
+
+      on_directory(path);
+      walk_directory(path, parents, on_directory, on_file);
+      parents.erase(parent);
+    }
+  }
+
+  /* Lists desktop files with their ids. When several directories contain
+   * the same id, the one found first hides the others, even if it is itself
+   * hidden. */
+  static void find_desktop_files(
+    const std::vector<std::string> &roots, DirStamps &dir_stamps,
+    std::vector<std::pair<std::string, std::string>> &files) {
+    std::unordered_set<std::string> seen_ids;
+
+    for (const auto &root : roots)
+      dir_stamps.emplace_back(root, dir_mtime(root));
+
+    for (const auto &root : roots) {
+      walk_directory(
+        root,
+        [&](const std::filesystem::path &dir) {
+          dir_stamps.emplace_back(dir, dir_mtime(dir));
+        },
+        [&](const std::filesystem::path &path) {
+          if (path.extension() != ".desktop")
+            return;
+
+          std::string id = desktop_id(path.lexically_relative(root));
+          if (seen_ids.insert(id).second)
+            files.emplace_back(std::move(id), path);
+        });
+    }
+  }
+
+  static std::vector<std::string> language_names() {
+    std::vector<std::string> names;
+    for (const gchar *const *name = g_get_language_names(); *name; name++)
+      names.emplace_back(*name);
+    return names;
+  }
+
+  static std::vector<std::string> current_desktops() {
+    std::vector<std::string> desktops;
+    const char *env = getenv("XDG_CURRENT_DESKTOP");
+    std::string_view list = env ? env : "";
+    while (!list.empty()) {
+      size_t end = std::min(list.find(':'), list.size());
+      if (end != 0)
+        desktops.emplace_back(list.substr(0, end));
+      list.remove_prefix(std::min(end + 1, list.size()));
+    }
+    return desktops;
+  }
+
+  static std::string environment(const std::vector<std::string> &languages,
+                                 const std::vector<std::string> &desktops) {
+    std::string result;
+    for (const auto &language : languages)
+      result += language + ":";
+    result += "\n";
+    for (const auto &desktop : desktops)
+      result += desktop + ":";
+    return result;
+  }
+
+  /* Values of desktop entry keys, as described in the Desktop Entry
+   * Specification. Lists are kept as they are, separated by ';'. */
+  static std::string unescape(std::string_view value) {
+    std::string result;
+    result.reserve(value.size());
+    for (size_t i = 0; i < value.size(); i++) {
+      if (value[i] != '\\' || i + 1 == value.size()) {
+        result.push_back(value[i]);
+        continue;
+      }
+
+      switch (value[++i]) {
+      case 's': result.push_back(' '); break;
+      case 'n': result.push_back('\n'); break;
+      case 't': result.push_back('\t'); break;
+      case 'r': result.push_back('\r'); break;
+      case '\\': result.push_back('\\'); break;
+      default:
+        result.push_back('\\');
+        result.push_back(value[i]);
+      }
+    }
+    return result;
+  }
+
+  static bool list_contains(std::string_view list,
+                            const std::vector<std::string> &values) {
+    while (!list.empty()) {
+      size_t end = std::min(list.find(';'), list.size());
+      std::string_view item = list.substr(0, end);
+      if (std::find(values.begin(), values.end(), item) != values.end())
+        return true;
+      list.remove_prefix(std::min(end + 1, list.size()));
+    }
+    return false;
+  }
+
+  static bool program_exists(const std::string &program) {
+    if (program.find('/') != std::string::npos)
+      return access(program.c_str(), X_OK) == 0;
+
+    gchar *path = g_find_program_in_path(program.c_str());
+    bool found = path != nullptr;
+    g_free(path);
+    return found;
+  }
+
+  /* Returns nullopt for entries that should not be shown. */
+  static std::optional<DesktopEntry> parse_desktop_file(
+    const std::string &id, const std::string &path,
+    const std::vector<std::string> &languages,
+    const std::vector<std::string> &desktops) {
+    /* Package managers rewrite desktop files in place: they are read rather
+     * than mapped. */
+    auto data = read_file(path);
+    if (!data)
+      return std::nullopt;
+
+    std::string_view text((const char*)data->data(), data->size());
+
+    enum { Name, GenericName, Keywords, LocalizedCount };
+    static const std::string_view localized_keys[] = {
+      "Name", "GenericName", "Keywords",
+    };
+
+    /* Localized values keep the one for the preferred language: lower
+     * ranks are better. */
+    std::string_view localized[LocalizedCount];
+    size_t ranks[LocalizedCount];
+    std::fill(std::begin(ranks), std::end(ranks), SIZE_MAX);
+
+    std::string_view type, exec, icon, categories, try_exec;
+    std::string_view only_show_in, not_show_in;
+    bool no_display = false, hidden = false, in_group = false;
+    bool dbus_activatable = false;
+
+    while (!text.empty()) {
+      size_t end = std::min(text.find('\n'), text.size());
+      std::string_view line = text.substr(0, end);
+      text.remove_prefix(std::min(end + 1, text.size()));
+
+      if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+
+      if (line.empty() || line[0] == '#')
+        continue;
+
+      if (line[0] == '[') {
+        if (in_group) break;
+        in_group = line == "[Desktop Entry]";
+        continue;
+      }
+
+      if (!in_group)
+        continue;
+
+      size_t equal = line.find('=');
+      if (equal == std::string_view::npos)
+        continue;
+
+      std::string_view key = line.substr(0, equal);
+      std::string_view value = line.substr(equal + 1);
+      while (!key.empty() && key.back() == ' ')
+        key.remove_suffix(1);
+      while (!value.empty() && value.front() == ' ')
+        value.remove_prefix(1);
+
+      std::string_view locale;
+      if (size_t bracket = key.find('['); bracket != std::string_view::npos &&
+          key.back() == ']') {
+        locale = key.substr(bracket + 1, key.size() - bracket - 2);
+        key = key.substr(0, bracket);
+      }
+
+      bool localized_key = false;
+      for (size_t i = 0; i < LocalizedCount; i++) {
+        if (key != localized_keys[i])
+          continue;
+
+        localized_key = true;
+        size_t rank = languages.size();
+        if (!locale.empty()) {
+          auto it = std::find(languages.begin(), languages.end(), locale);
+          if (it == languages.end())
+            break;
+          rank = it - languages.begin();
+        }
+
+        if (rank < ranks[i]) {
+          ranks[i] = rank;
+          localized[i] = value;
+        }
+        break;
+      }
+
+      if (localized_key || !locale.empty())
+        continue;
+
+      if (key == "Type") type = value;
+      else if (key == "Exec") exec = value;
+      else if (key == "TryExec") try_exec = value;
+      else if (key == "Icon") icon = value;
+      else if (key == "Categories") categories = value;
+      else if (key == "OnlyShowIn") only_show_in = value;
+      else if (key == "NotShowIn") not_show_in = value;
+      else if (key == "NoDisplay") no_display = value == "true";
+      else if (key == "Hidden") hidden = value == "true";
+      else if (key == "DBusActivatable") dbus_activatable = value == "true";
+    }
+
+    /* Applications started through D-Bus do not need an Exec line. */
+    if (type != "Application" || no_display || hidden ||
+        (exec.empty() && !dbus_activatable) || localized[Name].empty())
+      return std::nullopt;
+
+    if ((!only_show_in.empty() && !list_contains(only_show_in, desktops)) ||
+        list_contains(not_show_in, desktops))
+      return std::nullopt;
+
+    if (!try_exec.empty() && !program_exists(unescape(try_exec)))
+      return std::nullopt;
+
+    DesktopEntry entry;
+    auto field = [&](DesktopField name) -> std::string& {
+      return entry.fields[(size_t)name];
+    };
+
+    field(DesktopField::Id) = id;
+    field(DesktopField::Path) = path;
+    field(DesktopField::Name) = unescape(localized[Name]);
+    field(DesktopField::Key) = search_key(field(DesktopField::Name).c_str());
+    field(DesktopField::Exec) = unescape(exec);
+
+    /* Icon names are sometimes given with an extension, which Gio drops as
+     * well. */
+    std::string icon_name = unescape(icon);
+    if (!icon_name.empty() && icon_name[0] != '/') {
+      for (std::string_view ext : {".png", ".svg", ".xpm"}) {
+        if (icon_name.ends_with(ext))
+          icon_name.resize(icon_name.size() - ext.size());
+      }
+    }
+    field(DesktopField::Icon) = std::move(icon_name);
+
+    std::string program = executable(field(DesktopField::Exec));
+    std::string terms = unescape(localized[GenericName]) + " " +
+      unescape(localized[Keywords]) + " " + unescape(categories) + " " +
+      program.substr(program.rfind('/') + 1);
+    field(DesktopField::Terms) = search_key(terms.c_str());
+
+    return entry;
+  }
+};
@@ -1,8 +1,13 @@
 #pragma once
 
+#include "frame_scheduler.hpp"
 #include "gl_texture.hpp"
 #include "icon_fetcher.hpp"
+#include "launch_queue.hpp"
+#include "memory_ledger.hpp"
+#include "thread_role.hpp"
 #include "video_player_parameters.hpp"
+#include <deque>
 #include <filesystem>
 #include <future>
 #include <thread>
@@ -27,16 +32,20 @@ struct FileEntry {
 
   std::shared_future<Glib::RefPtr<Gio::FileInfo>> info;
 
+  MemoryCharge charge;
+
   FileEntry(std::promise<Glib::RefPtr<Gio::FileInfo>> &info_promise,
             const fs::directory_entry &entry):
     path(entry.path()),
     is_directory(entry.is_directory()),
-    info(info_promise.get_future())
+    info(info_promise.get_future()),
+    charge(MemoryCategory::FileEntries,
+           sizeof(FileEntry) + path.native().capacity())
     {}
 
-  std::optional<GLTexture*> icon(IconFetcher &fetcher) {
+  std::optional<GLTexture*> icon(IconFetcher &fetcher, float size) {
     if (info.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
-      return fetcher.fetch_texture(info.get());
+      return fetcher.fetch_texture(info.get(), size);
     }
 
     return std::nullopt;
@@ -74,6 +83,16 @@ class FileBrowser {
   CompareId comparator;
   std::set<size_t, CompareId> sorted_ids;
 
+  /* Entries found by the directory loader wait here until the main thread
+   * merges them into the sorted list, a batch at a time. */
+  static constexpr size_t MERGE_BATCH_SIZE = 64;
+
+  FrameScheduler &scheduler;
+  LaunchQueue &launches;
+  std::mutex staging_mutex;
+  std::deque<FileEntry> staged_files;
+  bool merge_queued = false;
+
   tbb::concurrent_bounded_queue<
     std::optional<std::pair<std::promise<Glib::RefPtr<Gio::FileInfo>>, fs::path>>
     > info_queue;
@@ -83,10 +102,12 @@ class FileBrowser {
 
   bool show_hidden, only_show_videos;
 public:
-  FileBrowser():
+  FileBrowser(FrameScheduler &scheduler, LaunchQueue &launches):
     path(fs::current_path()),
     comparator(files),
     sorted_ids(comparator),
+    scheduler(scheduler),
+    launches(launches),
     updater_thread([this](std::stop_token token) { load_directory(token); }),
     info_lookup_thread(
       std::jthread([this](std::stop_token token) { lookup_info(token); })),
@@ -111,12 +132,25 @@ public:
     files.clear();
     sorted_ids.clear();
 
+    {
+      std::lock_guard<std::mutex> lock(staging_mutex);
+      staged_files.clear();
+    }
+
     updater_thread =
         std::jthread([this](std::stop_token token) { load_directory(token); });
   }
 
   std::mutex &get_mutex() { return mutex; }
 
+  /* Gives back the spare capacity of the entry lists. */
+  void shrink() {
+    std::lock_guard<std::mutex> staging_lock(staging_mutex);
+    std::lock_guard<std::mutex> lock(mutex);
+    files.shrink_to_fit();
+    staged_files.shrink_to_fit();
+  }
+
   auto sorted_files() {
     return sorted_ids | std::views::transform([this](size_t i) {
       return std::ref(this->files[i]);
@@ -148,9 +182,9 @@ public:
 
         ImGui::TableNextColumn();
 
-        auto icon = icons.fetch_texture("view-refresh");
         bool clicked = false;
         float height = ImGui::GetTextLineHeightWithSpacing();
+        auto icon = icons.fetch_texture("view-refresh", height);
         ImVec2 icon_size(height, height);
         if (icon)
           clicked = icon.value()->draw_button(icon_size);
@@ -177,7 +211,7 @@ public:
           width -= ImGui::GetStyle().FramePadding.x * 2.0;
           ImVec2 icon_size(width, width);
 
-          auto icon = icons.fetch_texture("folder");
+          auto icon = icons.fetch_texture("folder", width);
           if (icon) {
             icon.value()->draw(icon_size);
           } else {
@@ -342,7 +376,7 @@ public:
           width -= ImGui::GetStyle().FramePadding.x * 2.0;
           ImVec2 icon_size(width, width);
 
-          auto icon = entry.icon(icons);
+          auto icon = entry.icon(icons, width);
           if (icon) {
             icon.value()->draw(icon_size);
           } else if (entry.is_directory)
@@ -353,7 +387,12 @@ public:
           ImGui::TableNextColumn();
           float name_width = ImGui::GetContentRegionAvail().x;
           ImVec2 name_size(name_width, width);
-          if (ImGui::Button(entry.path.filename().c_str(), name_size)) {
+          bool clicked = ImGui::Button(entry.path.filename().c_str(),
+                                       name_size);
+          if (!entry.is_directory && ImGui::IsItemHovered())
+            launches.warm(VideoPlayerParameters::PROGRAM);
+
+          if (clicked) {
             if (entry.is_directory) {
               set_path(entry.path);
               std::string path_str = current_path();
@@ -365,11 +404,11 @@ public:
               args.push_back("--video");
               args.push_back(entry.path);
 
-              try {
-                Glib::spawn_async(fs::current_path(), args);
-              } catch (const Glib::SpawnError &e) {
-                std::cerr << "spawn error: " << e.what() << "\n";
-              }
+              LaunchCommand command;
+              command.overlay_key = overlay_key_argument(args);
+              command.argv = std::move(args);
+              launches.launch(entry.path.string(), entry.path.filename(),
+                              std::move(command));
             }
           }
         }
@@ -386,6 +425,7 @@ public:
 
 private:
   void load_directory(std::stop_token token) {
+    set_thread_role(ThreadRole::Background, "fs-scan");
     {
       std::lock_guard<std::mutex> lock(mutex);
       files.clear();
@@ -400,15 +440,39 @@ private:
         FileEntry file(promise, entry);
         info_queue.emplace(std::make_pair(std::move(promise), entry));
 
-        std::lock_guard<std::mutex> lock(mutex);
-        files.emplace_back(std::move(file));
-        sorted_ids.insert(files.size() - 1);
+        std::lock_guard<std::mutex> lock(staging_mutex);
+        staged_files.emplace_back(std::move(file));
+        if (!merge_queued) {
+          merge_queued = true;
+          scheduler.post(JobPriority::Normal,
+                         [this]() { merge_staged_files(); });
+        }
       }
     }
     catch (const fs::filesystem_error &e) {}
   }
 
+  void merge_staged_files() {
+    std::lock_guard<std::mutex> staging_lock(staging_mutex);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    size_t count = std::min(MERGE_BATCH_SIZE, staged_files.size());
+    for (size_t i = 0; i < count; i++) {
+      files.emplace_back(std::move(staged_files.front()));
+      staged_files.pop_front();
+      sorted_ids.insert(files.size() - 1);
+    }
+
+    if (staged_files.empty())
+      merge_queued = false;
+    else {
+      scheduler.post(JobPriority::Normal,
+                     [this]() { merge_staged_files(); });
+    }
+  }
+
   void lookup_info(std::stop_token token) {
+    set_thread_role(ThreadRole::InteractiveIO, "fs-info");
     std::optional<std::pair<std::promise<Glib::RefPtr<Gio::FileInfo>>, fs::path>>
       job;
     while (!token.stop_requested()) {
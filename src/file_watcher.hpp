@@ -0,0 +1,117 @@
+#pragma once
+
+#include "thread_role.hpp"
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/* Reports files created, modified, moved or deleted inside a set of
+ * directories. The callback receives the watched directory and the name of
+ * the file within it, and runs on the watcher thread.
+ *
+ * When the kernel queue overflows, events are lost: the callback then
+ * receives an empty directory, and everything watched must be checked
+ * again. */
+class FileWatcher {
+public:
+  using Callback = std::function<void(const std::string &dir,
+                                      const std::string &name)>;
+
+private:
+  static constexpr uint32_t WATCH_MASK =
+    IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+    IN_DELETE_SELF | IN_MOVE_SELF;
+
+  int fd;
+  Callback callback;
+
+  std::mutex mutex;
+  std::unordered_map<int, std::string> watch_to_dir;
+  std::unordered_map<std::string, int> dir_to_watch;
+
+  std::jthread watcher_thread;
+
+public:
+  FileWatcher(Callback callback):
+    fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+    callback(std::move(callback)),
+    watcher_thread([this](std::stop_token token) { read_events(token); })
+    {}
+
+  ~FileWatcher() {
+    watcher_thread.request_stop();
+    watcher_thread.join();
+    if (fd != -1) close(fd);
+  }
+
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher &operator=(const FileWatcher&) = delete;
+
+  bool watch(const std::string &dir) {
+    if (fd == -1) return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (dir_to_watch.contains(dir))
+      return true;
+
+    int wd = inotify_add_watch(fd, dir.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if (wd == -1)
+      return false;
+
+    watch_to_dir[wd] = dir;
+    dir_to_watch[dir] = wd;
+    return true;
+  }
+
+private:
+  void read_events(std::stop_token token) {
+    /* Not a background thread: if it is starved, the kernel queue
+     * overflows. */
+    set_thread_role(ThreadRole::Input, "file-watcher");
+    if (fd == -1) return;
+
+    alignas(inotify_event) char buffer[16 * 1024];
+    pollfd poll_fd{fd, POLLIN, 0};
+
+    while (!token.stop_requested()) {
+      if (poll(&poll_fd, 1, 250) <= 0)
+        continue;
+
+      ssize_t length;
+      while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + length;
+             ptr += sizeof(inotify_event) + ((inotify_event*)ptr)->len) {
+          const inotify_event *event = (const inotify_event*)ptr;
+
+          if (event->mask & IN_Q_OVERFLOW) {
+            callback("", "");
+            continue;
+          }
+
+          std::string dir;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = watch_to_dir.find(event->wd);
+            if (it == watch_to_dir.end())
+              continue;
+
+            dir = it->second;
+            if (event->mask & IN_IGNORED) {
+              dir_to_watch.erase(it->second);
+              watch_to_dir.erase(it);
+              continue;
+            }
+          }
+
+          callback(dir, event->len ? event->name : "");
+        }
+      }
+    }
+  }
+};
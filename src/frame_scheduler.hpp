@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+enum class JobPriority {
+  High, Normal, Low, Count
+};
+
+struct FrameSchedulerStats {
+  uint64_t frames = 0, overruns = 0, jobs_run = 0;
+  int64_t last_frame_us = 0, max_frame_us = 0;
+  size_t pending = 0;
+};
+
+static constexpr int64_t DEFAULT_FRAME_BUDGET_US = 2000;
+
+/* Work that has to happen on the main thread, such as texture uploads or
+ * merging results from worker threads into the lists being drawn. Jobs can
+ * be posted from any thread and run once per frame in priority order until
+ * the budget is spent; the rest waits for the next frame. At least one job
+ * runs each frame so that a job longer than the budget cannot stall the
+ * queue. */
+class FrameScheduler {
+  using Clock = std::chrono::steady_clock;
+
+  std::mutex mutex;
+  std::array<std::deque<std::function<void()>>,
+             (size_t)JobPriority::Count> queues;
+
+  int64_t budget_us = DEFAULT_FRAME_BUDGET_US;
+  FrameSchedulerStats stats;
+
+public:
+  void post(JobPriority priority, std::function<void()> job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    queues[(size_t)priority].emplace_back(std::move(job));
+  }
+
+  void run_jobs() {
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::microseconds(get_budget_us());
+
+    uint64_t jobs_run = 0;
+    while (jobs_run == 0 || Clock::now() < deadline) {
+      auto job = pop_job();
+      if (!job)
+        break;
+
+      job();
+      jobs_run++;
+    }
+
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      Clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.frames++;
+    stats.jobs_run += jobs_run;
+    stats.last_frame_us = elapsed;
+    stats.max_frame_us = std::max(stats.max_frame_us, elapsed);
+    if (elapsed > budget_us)
+      stats.overruns++;
+  }
+
+  int64_t get_budget_us() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return budget_us;
+  }
+
+  void set_budget_us(int64_t us) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget_us = us;
+  }
+
+  FrameSchedulerStats get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    FrameSchedulerStats result = stats;
+    for (const auto &queue : queues)
+      result.pending += queue.size();
+    return result;
+  }
+
+private:
+  std::function<void()> pop_job() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &queue : queues) {
+      if (!queue.empty()) {
+        auto job = std::move(queue.front());
+        queue.pop_front();
+        return job;
+      }
+    }
+
+    return nullptr;
+  }
+};
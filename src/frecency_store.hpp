@@ -0,0 +1,180 @@
+#pragma once
+
+#include "thread_role.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <giomm.h>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+/* Who would define C as 1? */
+#ifdef C
+#undef C
+#endif
+
+#include <tbb/concurrent_queue.h>
+
+/* Remembers which applications are launched, scored by frecency: every
+ * launch adds 1 to the score of an application, and scores decay by half
+ * every week, so that both frequently and recently used applications come
+ * first.
+ *
+ * Launches are saved to $XDG_DATA_HOME/launcher-openvr-overlay/launches.
+ * The file is written from a separate thread, to a temporary file that is
+ * synced before it replaces the previous one: a crash leaves either the old
+ * or the new contents, never a truncated file. */
+class FrecencyStore {
+  static constexpr const char *FILE_HEADER =
+    "launcher-openvr-overlay launches 1";
+  static constexpr double HALF_LIFE = 7 * 24 * 3600;
+
+  struct Entry {
+    double score;
+    int64_t time; /* When score was last updated, in seconds. */
+  };
+
+  std::unordered_map<std::string, Entry> entries;
+  std::string path;
+
+  /* Contents to write, or nullopt to stop the thread. */
+  tbb::concurrent_bounded_queue<std::optional<std::string>> write_queue;
+  std::jthread writer;
+
+public:
+  FrecencyStore():
+    path(Glib::build_filename(
+           Glib::get_user_data_dir(),
+           Glib::build_filename("launcher-openvr-overlay", "launches"))),
+    writer([this]() { write_files(); }) {
+    load();
+  }
+
+  ~FrecencyStore() {
+    write_queue.push(std::nullopt);
+  }
+
+  /* Score of an application at the current time, 0 if it was never
+   * launched. */
+  double score(const std::string &id) const {
+    auto it = entries.find(id);
+    if (it == entries.end())
+      return 0;
+
+    return decayed(it->second, now());
+  }
+
+  void record_launch(const std::string &id) {
+    if (id.empty())
+      return;
+
+    int64_t time = now();
+    Entry &entry = entries.try_emplace(id, Entry{0, time}).first->second;
+    entry.score = decayed(entry, time) + 1;
+    entry.time = time;
+
+    write_queue.push(serialize());
+  }
+
+private:
+  static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  static double decayed(const Entry &entry, int64_t time) {
+    double elapsed = std::max<int64_t>(time - entry.time, 0);
+    return entry.score * std::exp2(-elapsed / HALF_LIFE);
+  }
+
+  void load() {
+    std::ifstream in(path);
+    std::string header;
+    if (!std::getline(in, header) || header != FILE_HEADER)
+      return;
+
+    Entry entry;
+    std::string id;
+    while (in >> entry.score >> entry.time && in.get() == '\t' &&
+           std::getline(in, id)) {
+      if (std::isfinite(entry.score) && entry.score > 0)
+        entries[id] = entry;
+    }
+  }
+
+  std::string serialize() const {
+    std::ostringstream out;
+    out.imbue(std::locale("C"));
+    out << FILE_HEADER << "\n";
+    for (const auto &[id, entry] : entries)
+      out << entry.score << " " << entry.time << "\t" << id << "\n";
+
+    return out.str();
+  }
+
+  void write_files() {
+    set_thread_role(ThreadRole::Background, "frecency-write");
+
+    std::optional<std::string> contents;
+    while (true) {
+      write_queue.pop(contents);
+      if (!contents)
+        break;
+
+      /* Only the latest contents matter. */
+      std::optional<std::string> newer;
+      while (write_queue.try_pop(newer)) {
+        if (!newer) {
+          save(*contents);
+          return;
+        }
+        contents = std::move(newer);
+      }
+
+      save(*contents);
+    }
+  }
+
+  void save(const std::string &contents) const {
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    if (fd == -1)
+      return;
+
+    size_t written = 0;
+    while (written < contents.size()) {
+      ssize_t n = write(fd, contents.data() + written,
+                        contents.size() - written);
+      if (n < 0) break;
+      written += n;
+    }
+
+    bool ok = written == contents.size() && fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+      unlink(tmp_path.c_str());
+      return;
+    }
+
+    /* Makes the rename itself durable. */
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd != -1) {
+      fsync(dir_fd);
+      close(dir_fd);
+    }
+  }
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Who would define C as 1? */
+#ifdef C
+#undef C
+#endif
+
+#include <tbb/parallel_for.h>
+
+/* Fuzzy matching of search keys, in the spirit of fzf: every character of
+ * the query has to appear in order in the key, and matches are scored so
+ * that characters at the start of words and runs of consecutive characters
+ * rank first. "vsc" thus finds "visual studio code" before anything that
+ * merely contains those letters.
+ *
+ * Keys are packed in a single buffer, each with a 64-bit mask of the bytes
+ * it contains. Most keys are rejected by comparing masks, then memchr
+ * checks that the query is a subsequence; only the remaining keys are
+ * scored. */
+class FuzzyMatcher {
+  static constexpr int MATCH_SCORE = 16;
+  static constexpr int BOUNDARY_BONUS = 8;
+  static constexpr int FIRST_CHAR_BONUS = 4;
+  static constexpr int CONSECUTIVE_BONUS = 4;
+  static constexpr int GAP_OPEN = 3;
+  static constexpr int GAP_EXTEND = 1;
+
+  /* Only this many bytes of a key are scored; matches further away still
+   * count, with the lowest score. */
+  static constexpr size_t MAX_SCORED_LENGTH = 128;
+
+  /* Below this many candidates, scoring on a single thread is faster. */
+  static constexpr size_t PARALLEL_THRESHOLD = 512;
+
+  std::string packed_keys;
+  std::vector<uint32_t> offsets;
+  std::vector<uint64_t> masks;
+
+  static bool is_boundary(std::string_view key, size_t i) {
+    if (i == 0) return true;
+    unsigned char prev = key[i - 1];
+    return prev < 0x80 && !isalnum(prev);
+  }
+
+public:
+  FuzzyMatcher() = default;
+
+  static uint64_t byte_mask(std::string_view text) {
+    uint64_t mask = 0;
+    for (unsigned char c : text)
+      mask |= uint64_t(1) << (c & 63);
+    return mask;
+  }
+
+  FuzzyMatcher(const std::vector<std::string_view> &keys) {
+    offsets.reserve(keys.size() + 1);
+    masks.reserve(keys.size());
+    for (std::string_view key : keys) {
+      offsets.push_back(packed_keys.size());
+      packed_keys.append(key);
+      masks.push_back(byte_mask(key));
+    }
+    offsets.push_back(packed_keys.size());
+  }
+
+  size_t size() const { return masks.size(); }
+
+  std::string_view key(size_t id) const {
+    return std::string_view(packed_keys).substr(
+      offsets[id], offsets[id + 1] - offsets[id]);
+  }
+
+  /* Returns a score for the best alignment of the query in the key, or -1
+   * if the key does not contain it. */
+  int score(size_t id, std::string_view query, uint64_t query_mask) const {
+    if ((masks[id] & query_mask) != query_mask)
+      return -1;
+
+    std::string_view text = key(id);
+    const char *ptr = text.data(), *end = text.data() + text.size();
+    for (char c : query) {
+      ptr = (const char*)memchr(ptr, c, end - ptr);
+      if (!ptr) return -1;
+      ptr++;
+    }
+
+    if (query.empty())
+      return 0;
+
+    text = text.substr(0, MAX_SCORED_LENGTH);
+    size_t n = text.size(), m = query.size();
+    if (m > n)
+      return 0;
+
+    /* row[j]: best score with the current query character matched at j.
+     * Anything at or below NONE means it cannot be; NONE is far enough from
+     * INT32_MIN for gap penalties not to overflow. */
+    static constexpr int NONE = INT32_MIN / 2;
+    int prev_row[MAX_SCORED_LENGTH], row[MAX_SCORED_LENGTH];
+    int result = NONE;
+
+    for (size_t i = 0; i < m; i++) {
+      int gap = NONE;
+      for (size_t j = 0; j < n; j++) {
+        /* Best alignment of the previous characters ending before j - 1,
+         * with the gap in between paid for. */
+        if (i > 0 && j >= 2)
+          gap = std::max(gap - GAP_EXTEND, prev_row[j - 2] - GAP_OPEN);
+
+        if (text[j] != query[i]) {
+          row[j] = NONE;
+          continue;
+        }
+
+        int bonus = MATCH_SCORE;
+        if (is_boundary(text, j))
+          bonus += BOUNDARY_BONUS + (j == 0 ? FIRST_CHAR_BONUS : 0);
+
+        if (i == 0)
+          row[j] = bonus;
+        else {
+          int consecutive = j >= 1 && prev_row[j - 1] > NONE ?
+            prev_row[j - 1] + CONSECUTIVE_BONUS : NONE;
+          int best = std::max(consecutive, gap);
+          row[j] = best <= NONE ? NONE : best + bonus;
+        }
+      }
+
+      std::copy(row, row + n, prev_row);
+    }
+
+    for (size_t j = 0; j < n; j++)
+      result = std::max(result, prev_row[j]);
+
+    /* Matched, but only beyond the scored prefix. */
+    return result <= NONE ? 0 : std::max(result, 0);
+  }
+
+  /* Keeps the candidates that match the query, best first. Ties keep the
+   * order of the candidates. */
+  std::vector<uint32_t> rank(std::string_view query,
+                             const std::vector<uint32_t> &candidates) const {
+    return rank(query, candidates,
+                [this](uint32_t id, std::string_view query,
+                       uint64_t query_mask) {
+                  return score(id, query, query_mask);
+                });
+  }
+
+  /* Same, for candidates scored by another function, e.g. when they are
+   * split between several matchers. */
+  template <typename Score>
+  static std::vector<uint32_t> rank(std::string_view query,
+                                    const std::vector<uint32_t> &candidates,
+                                    Score score) {
+    uint64_t query_mask = byte_mask(query);
+    std::vector<int> scores(candidates.size());
+
+    auto score_range = [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++)
+        scores[i] = score(candidates[i], query, query_mask);
+    };
+
+    if (candidates.size() < PARALLEL_THRESHOLD)
+      score_range(0, candidates.size());
+    else {
+      tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, candidates.size(), 128),
+        [&](const tbb::blocked_range<size_t> &range) {
+          score_range(range.begin(), range.end());
+        });
+    }
+
+    std::vector<uint32_t> order;
+    for (size_t i = 0; i < candidates.size(); i++) {
+      if (scores[i] >= 0)
+        order.push_back(i);
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return scores[a] > scores[b];
+    });
+
+    for (uint32_t &i : order)
+      i = candidates[i];
+
+    return order;
+  }
+};
@@ -1,58 +1,100 @@
 #pragma once
 
 #include <GL/glew.h>
+#include <algorithm>
 #include <cstddef>
 #include <imgui.h>
 #include <utility>
 
 #include "icon.hpp"
-
+#include "memory_ledger.hpp"
+#include "texture_compression.hpp"
+#include "texture_pool.hpp"
+
+/* Storage comes from the TexturePool and may be larger than the image,
+ * which then only covers its top-left corner. The bytes the image uses and
+ * the rest of the storage are accounted for separately: budgets apply to
+ * the former. */
 class GLTexture {
-  GLuint texture;
+  PooledTexture storage;
   size_t w, h;
+  MemoryCharge charge;
+  MemoryCharge slack_charge;
 
 public:
-  GLTexture() {
-    glGenTextures(1, &texture);
+  GLTexture():
+    charge(MemoryCategory::Textures, 0),
+    slack_charge(MemoryCategory::TextureSlack, 0) {
     w = h = 0;
   }
 
   ~GLTexture() {
-    if (texture)
-      glDeleteTextures(1, &texture);
+    TexturePool::get().release(storage);
   }
 
   GLTexture(const GLTexture&) = delete;
   GLTexture& operator=(const GLTexture&) = delete;
 
-  GLTexture(GLTexture &&source): texture(0) {
+  GLTexture(GLTexture &&source):
+    charge(std::move(source.charge)),
+    slack_charge(std::move(source.slack_charge)) {
     w = source.w;
     h = source.h;
-    std::swap(texture, source.texture);
+    std::swap(storage, source.storage);
   }
 
   GLTexture &operator=(GLTexture &&source) {
     w = source.w;
     h = source.h;
-    std::swap(texture, source.texture);
+    std::swap(storage, source.storage);
+    std::swap(charge, source.charge);
+    std::swap(slack_charge, source.slack_charge);
     return *this;
   }
 
-  void load(void *rgba, size_t w, size_t h) {
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0,
-                 GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+  /* When a pixel unpack buffer is bound, data is an offset into it. */
+  void load(TextureFormat format, const void *data, size_t data_size,
+            size_t w, size_t h) {
+    if (!storage.name || storage.format != format ||
+        storage.width < w || storage.height < h) {
+      TexturePool::get().release(storage);
+      storage = TexturePool::get().acquire(format, w, h);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, storage.name);
+    if (format == TextureFormat::RGBA8) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h,
+                      GL_RGBA, GL_UNSIGNED_BYTE, data);
+    }
+    else {
+      /* Blocks cover whole multiples of 4 pixels. */
+      glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+                                (w + 3) / 4 * 4, (h + 3) / 4 * 4,
+                                texture_internal_format(format),
+                                data_size, data);
+    }
     this->w = w;
     this->h = h;
+
+    size_t used = texture_data_size(format, w, h);
+    charge.set(used);
+    slack_charge.set(storage.bytes - std::min(used, storage.bytes));
+  }
+
+  void load(void *rgba, size_t w, size_t h) {
+    load(TextureFormat::RGBA8, rgba, w * h * 4, w, h);
   }
 
   void load(const Icon &icon) {
-    load((void*)icon.rgba_data.data(), icon.width, icon.height);
+    if (icon.format == TextureFormat::RGBA8)
+      load((void*)icon.rgba_data.data(), icon.width, icon.height);
+    else {
+      load(icon.format, icon.blocks.data(), icon.blocks.size(),
+           icon.width, icon.height);
+    }
   }
 
-  GLuint handle() const { return texture; }
+  GLuint handle() const { return storage.name; }
 
   size_t width() const  { return w; }
   size_t height() const { return h; }
@@ -68,10 +110,24 @@ public:
   }
 
   bool draw_button(ImVec2 max_size) {
-    return ImGui::ImageButton(texture, size_to_fit(max_size));
+    return ImGui::ImageButton(storage.name, size_to_fit(max_size),
+                              ImVec2(0, 0), uv_max());
   }
 
   void draw(ImVec2 max_size) {
-    return ImGui::Image(texture, size_to_fit(max_size));
+    return ImGui::Image(storage.name, size_to_fit(max_size),
+                        ImVec2(0, 0), uv_max());
+  }
+
+private:
+  /* Stops half a texel short of the image's edge when the storage is
+   * larger, so that filtering does not blend in whatever lies past it. */
+  ImVec2 uv_max() const {
+    auto edge = [](size_t size, size_t storage_size) {
+      if (size >= storage_size) return 1.0f;
+      return (size - 0.5f) / storage_size;
+    };
+
+    return ImVec2(edge(w, storage.width), edge(h, storage.height));
   }
 };
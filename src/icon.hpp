@@ -4,34 +4,117 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include <cstring>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "image_decoder.hpp"
+#include "memory_ledger.hpp"
+#include "texture_compression.hpp"
 
+/* Fast 64-bit hash of an image, used to share one texture between icons
+ * with identical pixels. Four independent lanes keep the multiplies
+ * pipelined. */
+static uint64_t hash_pixels(const std::vector<uint32_t> &rgba, size_t width,
+                            size_t height) {
+  static constexpr uint64_t K0 = 0x9E3779B97F4A7C15ull;
+  static constexpr uint64_t K1 = 0xFF51AFD7ED558CCDull;
+
+  auto mix = [](uint64_t h, uint64_t v) {
+    h ^= v * K1;
+    h = (h << 31) | (h >> 33);
+    return h * K0;
+  };
+
+  uint64_t lanes[4] = {K0, K1, K0 ^ width, K1 ^ height};
+
+  const uint32_t *data = rgba.data();
+  size_t n = rgba.size();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    for (size_t lane = 0; lane < 4; lane++) {
+      uint64_t v;
+      memcpy(&v, data + i + lane * 2, sizeof(v));
+      lanes[lane] = mix(lanes[lane], v);
+    }
+  }
+
+  for (; i < n; i++)
+    lanes[i % 4] = mix(lanes[i % 4], data[i]);
+
+  uint64_t h = mix(mix(lanes[0], lanes[1]), mix(lanes[2], lanes[3]));
+  h ^= h >> 33;
+  h *= K1;
+  h ^= h >> 33;
+  return h;
+}
+
+/* Holds either RGBA pixels or, once compressed, the encoded blocks. The
+ * hash is always that of the original pixels. */
 struct Icon {
   std::vector<uint32_t> rgba_data;
   size_t width, height;
+  uint64_t hash;
+  TextureFormat format = TextureFormat::RGBA8;
+  std::vector<uint8_t> blocks;
+  MemoryCharge charge;
 
   Icon(std::vector<uint32_t> rgba_data, size_t width, size_t height):
     rgba_data(std::move(rgba_data)),
     width(width),
-    height(height)
+    height(height),
+    hash(hash_pixels(this->rgba_data, width, height)),
+    charge(MemoryCategory::DecodedIcons, this->rgba_data.size() * 4)
     {}
 
-  static std::optional<Icon> load(const std::optional<std::string> &path) {
+  Icon(TextureFormat format, std::vector<uint8_t> blocks, size_t width,
+       size_t height, uint64_t hash):
+    width(width),
+    height(height),
+    hash(hash),
+    format(format),
+    blocks(std::move(blocks)),
+    charge(MemoryCategory::DecodedIcons, this->blocks.size())
+    {}
+
+  /* Replaces the pixels with BC1 or BC3 blocks, unless the image is too
+   * small to be worth it. */
+  void compress() {
+    if (format != TextureFormat::RGBA8)
+      return;
+
+    format = choose_texture_format(rgba_data.data(), width, height);
+    if (format == TextureFormat::RGBA8)
+      return;
+
+    blocks = compress_texture(rgba_data.data(), width, height, format);
+    rgba_data = {};
+    charge.set(blocks.size());
+  }
+
+  /* The size is only used by vector images, which are rendered to fit in a
+   * square of that many pixels. */
+  static std::optional<Icon> load(const std::optional<std::string> &path,
+                                  size_t size = 0) {
     if (!path)
       return std::nullopt;
 
-    int w, h, comp;
-    void *data = stbi_load(path->c_str(), &w, &h, &comp, 4);
-    if (data) {
-      std::vector<uint32_t> icon_data(w * h);
-      memcpy(icon_data.data(), data, w * h * 4);
+    /* Icons and thumbnails can be rewritten while they are decoded: they
+     * are read rather than mapped. */
+    auto file = read_file(*path);
+    if (!file || file->empty())
+      return std::nullopt;
 
-      free(data);
+    std::vector<uint32_t> icon_data;
+    size_t w = 0, h = 0;
+    bool decoded = decode_image(*file, size,
+                                [&](size_t width, size_t height) {
+      w = width;
+      h = height;
+      icon_data.resize(w * h);
+      return (uint8_t*)icon_data.data();
+    });
 
+    if (decoded)
       return Icon(std::move(icon_data), w, h);
-    }
 
     return std::nullopt;
   }
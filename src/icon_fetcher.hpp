@@ -1,18 +1,26 @@
 #pragma once
 
+#include "file_watcher.hpp"
+#include "frame_scheduler.hpp"
 #include "gl_texture.hpp"
+#include "icon_theme_index.hpp"
+#include "memory_ledger.hpp"
+#include "texture_disk_cache.hpp"
+#include "texture_uploader.hpp"
+#include "thread_role.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <filesystem>
-#include <future>
+#include <memory>
 #include <optional>
 #include <string>
+#include <cmath>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #include <giomm.h>
 
-extern "C" {
-#include "nkutils-xdg-theme.h"
-}
-
 /* Who would define C as 1? */
 #ifdef C
 #undef C
@@ -20,118 +28,266 @@ extern "C" {
 
 #include <tbb/concurrent_queue.h>
 
-static const gchar *const THEMES[] = {
-    "default", nullptr
-};
+/* Icons are requested at the size they are drawn at, rounded up to a
+ * multiple of 8 so that small layout changes do not cause new requests. */
+static size_t icon_pixel_size(float size) {
+  size_t pixels = std::max(std::ceil(size), 1.0f);
+  return (pixels + 7) / 8 * 8;
+}
 
-static const gchar *const FALLBACK_THEMES[] = {
-    "Adwaita", "gnome", "oxygen", nullptr
+struct TextureCacheStats {
+  uint64_t hits = 0, misses = 0, evictions = 0;
 };
 
+static constexpr size_t DEFAULT_TEXTURE_BUDGET = 256 * 1024 * 1024;
+
 class IconFetcher {
-  NkXdgThemeContext *context;
+  /* Slots live in a deque so that they can be referenced by id while new
+   * names are requested. Textures are shared through the TextureTable, so
+   * slots whose icons have identical pixels use the same one. There is one slot
+   * per name and size: the theme lookup picks the closest bitmap for that
+   * size, and scalable icons are rendered at exactly that size.
+   *
+   * Each time the file behind a slot changes, its generation is increased
+   * and the icon is loaded again; results computed for an older generation
+   * are dropped. The previous texture is shown until the new one is ready.
+   *
+   * Icons are uploaded by the TextureUploader once they are drawn. The
+   * finished texture is handed back through the frame scheduler, so a slot
+   * only switches textures between frames.
+   *
+   * Decoded pixels are only kept until they are uploaded. Once a texture has
+   * been dropped, the icon is decoded again the next time it is drawn. This
+   * is how textures that were not drawn recently are evicted when GL
+   * textures use more memory than the budget. */
+  struct IconSlot {
+    std::string name;
+    size_t size;
+    std::optional<std::string> path;
+    uint64_t generation = 0;
+    bool pending = true;
+
+    std::optional<Icon> icon;
+    bool needs_upload = false;
+    bool evicted = false;
+    std::shared_ptr<GLTexture> texture;
+    uint64_t last_used_frame = 0;
+  };
+
+  struct ResolveJob {
+    enum class Kind { Resolve, FileChanged } kind;
+    size_t id;
+    uint64_t generation;
+    std::string dir, name;
+  };
+
+  struct DecodeJob {
+    size_t id;
+    uint64_t generation;
+    std::string path;
+    size_t size;
+  };
+
+  std::unordered_map<std::string, std::vector<size_t>> name_to_ids;
+  std::deque<IconSlot> slots;
 
-  std::unordered_map<std::string, size_t> name_to_id;
+  std::mutex mutex;
 
-  std::vector<std::optional<std::string>> path_cache;
-  std::vector<std::shared_future<std::optional<Icon>>> icon_cache;
-  std::vector<std::optional<GLTexture>> texture_cache;
+  TextureUploader &uploader;
+  FrameScheduler &scheduler;
 
-  std::mutex mutex;
+  /* Large icons and thumbnails are encoded as BC1/BC3 by the decoders when
+   * the driver supports S3TC, and kept in the disk cache. */
+  const bool compress_textures;
+  TextureDiskCache disk_cache;
 
-  tbb::concurrent_bounded_queue<
-    std::optional<std::pair<std::promise<std::optional<Icon>>,
-                            std::optional<std::string>>>
-    > job_queue;
-  std::jthread worker;
+  uint64_t frame = 0;
+  size_t texture_budget = DEFAULT_TEXTURE_BUDGET;
+  double budget_scale = 1.0;
+  TextureCacheStats stats;
+
+  /* Icon names are resolved to paths by a single thread, which owns the
+   * theme index, and then handed to the decoders. */
+  tbb::concurrent_bounded_queue<std::optional<ResolveJob>> resolve_queue;
+  tbb::concurrent_bounded_queue<std::optional<DecodeJob>> decode_queue;
+
+  FileWatcher watcher;
+
+  std::jthread resolver;
+  std::vector<std::jthread> decoders;
 
 public:
-  IconFetcher():
-    worker([this](std::stop_token token){ load_icons_from_queue(token); })
+  /* Must be constructed on the thread that owns the GL context. */
+  IconFetcher(TextureUploader &uploader, FrameScheduler &scheduler):
+    uploader(uploader),
+    scheduler(scheduler),
+    compress_textures(GLEW_EXT_texture_compression_s3tc),
+    watcher([this](const std::string &dir, const std::string &name) {
+      resolve_queue.emplace(ResolveJob{
+          ResolveJob::Kind::FileChanged, 0, 0, dir, name});
+    }),
+    resolver([this](std::stop_token token){ resolve_icons_from_queue(token); })
     {
-      context = nk_xdg_theme_context_new(FALLBACK_THEMES, nullptr);
-      nk_xdg_theme_preload_themes_icon(context, THEMES);
+      size_t num_decoders =
+        std::clamp<size_t>(std::thread::hardware_concurrency() / 2, 1, 4);
+      for (size_t i = 0; i < num_decoders; i++) {
+        decoders.emplace_back([this](std::stop_token token) {
+          load_icons_from_queue(token);
+        });
+      }
+
+      auto thumbnails = Glib::build_filename(Glib::get_user_cache_dir(),
+                                             "thumbnails");
+      for (const char *size : {"normal", "large", "x-large", "xx-large"})
+        watcher.watch(Glib::build_filename(thumbnails, size));
+
+      for (const char *gtk_dir : {"gtk-4.0", "gtk-3.0"})
+        watcher.watch(Glib::build_filename(Glib::get_user_config_dir(),
+                                           gtk_dir));
     }
 
+  /* The threads are stopped before any member is destroyed: the resolver
+   * first, since it feeds the decoders. */
   ~IconFetcher() {
-    nk_xdg_theme_context_free(context);
-    job_queue.emplace(std::nullopt);
+    resolve_queue.emplace(std::nullopt);
+    resolver.join();
+
+    for (size_t i = 0; i < decoders.size(); i++)
+      decode_queue.emplace(std::nullopt);
+    for (auto &decoder : decoders)
+      decoder.join();
   }
 
-  size_t request_id(std::string &&name) {
+  /* Returns immediately: path lookup and decoding happen in the background,
+   * and fetch_texture reports the icon as missing until both are done. */
+  size_t request_id(std::string &&name, size_t size) {
     std::lock_guard<std::mutex> lock(mutex);
-    auto [it, inserted] = name_to_id.emplace(name, path_cache.size());
-    if (!inserted)
-      return it->second;
-
-    if (std::filesystem::path(name).is_absolute()) {
-      path_cache.emplace_back(name);
+    auto &ids = name_to_ids[name];
+    for (size_t id : ids) {
+      if (slots[id].size == size)
+        return id;
     }
-    else {
-      gchar *path = nk_xdg_theme_get_icon(context, THEMES, nullptr,
-                                          name.c_str(), 512, 1, false);
 
-      auto &path_obj = path_cache.emplace_back();
-      if (path)
-        path_obj = Glib::convert_const_gchar_ptr_to_stdstring(path);
-    }
+    size_t id = slots.size();
+    ids.push_back(id);
 
-    if (icon_cache.capacity() < path_cache.capacity())
-      icon_cache.reserve(path_cache.capacity());
-    icon_cache.resize(path_cache.size());
+    IconSlot &slot = slots.emplace_back();
+    slot.name = name;
+    slot.size = size;
+    resolve_queue.emplace(ResolveJob{
+        ResolveJob::Kind::Resolve, id, 0, "", std::move(name)});
 
-    if (texture_cache.capacity() < path_cache.capacity())
-      texture_cache.reserve(path_cache.capacity());
-    texture_cache.resize(path_cache.size());
+    return id;
+  }
 
-    return it->second;
+  /* Evicts the least recently drawn textures until the memory used by GL
+   * textures fits in the budget. Textures drawn during the previous frame
+   * are never evicted. */
+  void begin_frame() {
+    std::lock_guard<std::mutex> lock(mutex);
+    frame++;
+    evict_textures(texture_budget * budget_scale, frame - 1);
   }
 
-  std::optional<const Icon*> fetch_icon(size_t id) {
+  /* Keeps only the most recently drawn textures, up to the given size, and
+   * drops decoded icons that have not been uploaded yet. */
+  void trim(size_t working_set) {
     std::lock_guard<std::mutex> lock(mutex);
-    if (!icon_cache[id].valid()) {
-      std::promise<std::optional<Icon>> promise;
-      icon_cache[id] = promise.get_future();
-      job_queue.emplace(std::make_pair(std::move(promise), path_cache[id]));
+    for (IconSlot &slot : slots) {
+      if (slot.needs_upload) {
+        slot.icon.reset();
+        slot.needs_upload = false;
+        slot.evicted = true;
+      }
     }
 
-    if (icon_cache[id].wait_for(std::chrono::seconds(0)) ==
-        std::future_status::ready) {
-      const auto &icon = icon_cache[id].get();
-      if (icon)
-        return &icon.value();
-    }
+    evict_textures(working_set, frame + 1);
+  }
 
-    return std::nullopt;
+  size_t get_texture_budget() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return texture_budget;
   }
 
-  std::optional<GLTexture*> fetch_texture(size_t id) {
-    {
-      std::lock_guard<std::mutex> lock(mutex);
-      if (texture_cache[id])
-        return &texture_cache[id].value();
-    }
+  void set_texture_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    texture_budget = bytes;
+  }
+
+  /* Shrinks the budget while memory is scarce, without changing the value
+   * chosen by the user. */
+  void set_budget_scale(double scale) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget_scale = scale;
+  }
+
+  size_t effective_texture_budget() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return texture_budget * budget_scale;
+  }
 
-    auto icon = fetch_icon(id);
+  TextureCacheStats get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+  }
 
+  std::optional<GLTexture*> fetch_texture(size_t id) {
     std::lock_guard<std::mutex> lock(mutex);
-    if (texture_cache[id])
-        return &texture_cache[id].value();
+    IconSlot &slot = slots[id];
+    slot.last_used_frame = frame;
+    if (slot.needs_upload) {
+      if (slot.icon) {
+        /* Only the scheduler is used from the upload thread, since it
+         * outlives this object. */
+        uploader.upload(
+          std::move(*slot.icon),
+          [this, &scheduler = scheduler, id, generation = slot.generation](
+            std::shared_ptr<GLTexture> texture) {
+            scheduler.post(JobPriority::High,
+                           [this, id, generation, texture]() {
+                             publish(id, generation, texture);
+                           });
+          });
+      }
+      else
+        slot.texture.reset();
 
-    if (icon.has_value()) {
-      texture_cache[id].emplace();
-      texture_cache[id]->load(*icon.value());
-      return &texture_cache[id].value();
+      slot.icon.reset();
+      slot.needs_upload = false;
+    }
+    else if (slot.evicted && !slot.pending) {
+      slot.evicted = false;
+      set_path(id, slot.path);
     }
 
+    if (slot.texture) {
+      stats.hits++;
+      return slot.texture.get();
+    }
+
+    stats.misses++;
     return std::nullopt;
   }
 
-  std::optional<GLTexture*> fetch_texture(std::string &&name) {
-    return fetch_texture(request_id(std::forward<std::string>(name)));
+  /* Drops every texture, e.g. after the GL context was lost. Icons are
+   * decoded again from their files the next time they are drawn. */
+  void drop_textures() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (IconSlot &slot : slots) {
+      if (slot.texture) {
+        slot.texture.reset();
+        slot.evicted = true;
+      }
+    }
+  }
+
+  std::optional<GLTexture*> fetch_texture(std::string &&name, float size) {
+    return fetch_texture(request_id(std::forward<std::string>(name),
+                                    icon_pixel_size(size)));
   }
 
-  std::optional<GLTexture*> fetch_texture(const Glib::RefPtr<Gio::Icon> &icon) {
+  std::optional<GLTexture*> fetch_texture(const Glib::RefPtr<Gio::Icon> &icon,
+                                          float size) {
     if (!icon)
       return std::nullopt;
 
@@ -139,19 +295,20 @@ public:
     auto emblemed_icon = std::dynamic_pointer_cast<Gio::EmblemedIcon>(icon);
     if (themed_icon) {
       for (const auto &icon_name : themed_icon->get_names()) {
-        auto tex = fetch_texture(icon_name);
+        auto tex = fetch_texture(icon_name, size);
         if (tex.has_value())
           return tex;
       }
     }
     else if (emblemed_icon) {
-      return fetch_texture(emblemed_icon->get_icon());
+      return fetch_texture(emblemed_icon->get_icon(), size);
     }
 
-    return fetch_texture(icon->to_string());
+    return fetch_texture(icon->to_string(), size);
   }
 
-  std::optional<GLTexture*> fetch_texture(const Glib::RefPtr<Gio::FileInfo> &info) {
+  std::optional<GLTexture*> fetch_texture(const Glib::RefPtr<Gio::FileInfo> &info,
+                                          float size) {
     if (!info) return std::nullopt;
 
     static const std::pair<std::string, std::string>
@@ -168,24 +325,221 @@ public:
 
     for (const auto &attr : thumbnail_attributes) {
       if (info->get_attribute_boolean(attr.first)) {
-        auto tex = fetch_texture(info->get_attribute_as_string(attr.second));
+        auto tex = fetch_texture(info->get_attribute_as_string(attr.second),
+                                 size);
         if (tex.has_value())
           return tex;
       }
     }
 
-    return fetch_texture(info->get_icon());
+    return fetch_texture(info->get_icon(), size);
   }
 
 private:
+  /* Must be called with the mutex held. Textures drawn at or after
+   * keep_frame are never evicted.
+   *
+   * Textures shared with other slots or windows through the TextureTable
+   * are skipped: dropping one reference to them frees nothing, and the
+   * budget would then only be met by evicting everything else. */
+  void evict_textures(size_t budget, uint64_t keep_frame) {
+    auto &account = MemoryLedger::get(MemoryCategory::Textures);
+    if (account.bytes.load(std::memory_order_relaxed) <= (int64_t)budget)
+      return;
+
+    std::vector<std::pair<uint64_t, size_t>> candidates;
+    for (size_t id = 0; id < slots.size(); id++) {
+      const IconSlot &slot = slots[id];
+      if (slot.texture && slot.texture.use_count() == 1 &&
+          slot.last_used_frame < keep_frame)
+        candidates.emplace_back(slot.last_used_frame, id);
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    for (auto [last_used, id] : candidates) {
+      if (account.bytes.load(std::memory_order_relaxed) <= (int64_t)budget)
+        break;
+
+      /* Still the last reference, unless the texture was shared since. */
+      if (slots[id].texture.use_count() != 1)
+        continue;
+
+      slots[id].texture.reset();
+      slots[id].evicted = true;
+      stats.evictions++;
+    }
+  }
+
+  void publish(size_t id, uint64_t generation,
+               std::shared_ptr<GLTexture> texture) {
+    std::lock_guard<std::mutex> lock(mutex);
+    IconSlot &slot = slots[id];
+    if (slot.generation == generation)
+      slot.texture = std::move(texture);
+  }
+
+  void resolve_icons_from_queue(std::stop_token token) {
+    set_thread_role(ThreadRole::InteractiveIO, "icon-resolver");
+    IconThemeIndex theme_index = IconThemeIndex::load_or_build();
+    for (const auto &dir : theme_index.watched_directories())
+      watcher.watch(dir);
+
+    std::optional<ResolveJob> job;
+    while (!token.stop_requested()) {
+      resolve_queue.pop(job);
+      if (!job) break;
+
+      if (job->kind == ResolveJob::Kind::Resolve) {
+        size_t size;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          size = slots[job->id].size;
+        }
+
+        auto path = lookup_path(theme_index, job->name, size);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (slots[job->id].generation == job->generation)
+          set_path(job->id, std::move(path));
+      }
+      else
+        file_changed(theme_index, job->dir, job->name);
+    }
+  }
+
+  static std::optional<std::string> lookup_path(const IconThemeIndex &index,
+                                                const std::string &name,
+                                                size_t size) {
+    if (std::filesystem::path(name).is_absolute())
+      return name;
+    else
+      return index.lookup(name, size);
+  }
+
+  /* Called with the mutex held. */
+  void set_path(size_t id, std::optional<std::string> path) {
+    IconSlot &slot = slots[id];
+    slot.path = std::move(path);
+    slot.pending = slot.path.has_value();
+    if (slot.path)
+      decode_queue.emplace(DecodeJob{id, slot.generation, *slot.path,
+                                     slot.size});
+    else {
+      slot.icon.reset();
+      slot.needs_upload = true;
+    }
+  }
+
+  /* Called with the mutex held. */
+  void reload(size_t id, std::optional<std::string> path) {
+    slots[id].generation++;
+    set_path(id, std::move(path));
+  }
+
+  /* Rebuilds the index. Unless reload_all is set, only the icons that now
+   * resolve to a different file are reloaded. */
+  void revalidate(IconThemeIndex &index, bool reload_all) {
+    index = IconThemeIndex::load_or_build();
+    for (const auto &watched_dir : index.watched_directories())
+      watcher.watch(watched_dir);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t id = 0; id < slots.size(); id++) {
+      auto path = lookup_path(index, slots[id].name, slots[id].size);
+      if (reload_all || path != slots[id].path)
+        reload(id, std::move(path));
+    }
+  }
+
+  void file_changed(IconThemeIndex &index, const std::string &dir,
+                    const std::string &name) {
+    /* Events were lost: any icon or thumbnail may have changed. */
+    if (dir.empty()) {
+      revalidate(index, true);
+      return;
+    }
+
+    bool is_icon_dir = index.is_icon_directory(dir);
+
+    if ((is_icon_dir && name.empty()) || name == "index.theme" ||
+        name == "settings.ini" || index.has_theme(name)) {
+      /* The theme itself changed. */
+      revalidate(index, false);
+      return;
+    }
+
+    std::string path = dir + "/" + name;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = name_to_ids.find(path);
+    if (it != name_to_ids.end()) {
+      for (size_t id : it->second)
+        reload(id, path);
+    }
+
+    if (!is_icon_dir)
+      return;
+
+    for (const char *ext : ICON_EXTENSIONS) {
+      if (!name.ends_with(ext))
+        continue;
+
+      std::string icon_name = name.substr(0, name.size() - strlen(ext));
+      index.refresh(icon_name);
+
+      auto it = name_to_ids.find(icon_name);
+      if (it != name_to_ids.end()) {
+        for (size_t id : it->second) {
+          auto new_path = index.lookup(icon_name, slots[id].size);
+          if (new_path != slots[id].path || new_path == path)
+            reload(id, std::move(new_path));
+        }
+      }
+
+      break;
+    }
+  }
+
+  std::optional<Icon> load_icon(const std::string &path, size_t size) {
+    if (!compress_textures)
+      return Icon::load(path, size);
+
+    if (auto icon = disk_cache.load(path, size))
+      return icon;
+
+    int64_t mtime = file_mtime(path);
+    auto icon = Icon::load(path, size);
+    if (icon) {
+      icon->compress();
+      disk_cache.store(path, size, mtime, *icon);
+    }
+
+    return icon;
+  }
+
   void load_icons_from_queue(std::stop_token token) {
-    std::optional<std::pair<std::promise<std::optional<Icon>>,
-                            std::optional<std::string>>> job;
+    set_thread_role(ThreadRole::Background, "icon-decoder");
+    std::optional<DecodeJob> job;
     while (!token.stop_requested()) {
-      job_queue.pop(job);
+      decode_queue.pop(job);
       if (!job) return;
 
-      job->first.set_value(Icon::load(job->second));
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (slots[job->id].generation != job->generation)
+          continue;
+      }
+
+      auto icon = load_icon(job->path, job->size);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      IconSlot &slot = slots[job->id];
+      if (slot.generation != job->generation)
+        continue;
+
+      slot.icon = std::move(icon);
+      slot.needs_upload = true;
+      slot.pending = false;
     }
   }
 };
@@ -0,0 +1,548 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <giomm.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Who would define C as 1? */
+#ifdef C
+#undef C
+#endif
+
+#include <tbb/parallel_for.h>
+
+static const char *const FALLBACK_THEMES[] = {
+    "Adwaita", "gnome", "oxygen", nullptr
+};
+
+static const char *const ICON_EXTENSIONS[] = {
+    ".png", ".svg", ".xpm"
+};
+
+/* Modification time in nanoseconds, or -1 if the file does not exist. */
+static int64_t file_mtime(const std::string &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return -1;
+  return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+/* Name of the icon theme selected by the user, following the GTK settings
+ * first and GSettings second. */
+static std::string current_icon_theme() {
+  for (const char *gtk_dir : {"gtk-4.0", "gtk-3.0"}) {
+    auto settings = Glib::KeyFile::create();
+    try {
+      auto path = Glib::build_filename(Glib::get_user_config_dir(),
+                                       Glib::build_filename(gtk_dir,
+                                                            "settings.ini"));
+      if (settings->load_from_file(path))
+        return settings->get_string("Settings", "gtk-icon-theme-name");
+    } catch (const Glib::Error &e) {}
+  }
+
+  auto schemas = Gio::SettingsSchemaSource::get_default();
+  if (schemas && schemas->lookup("org.gnome.desktop.interface", true)) {
+    auto settings = Gio::Settings::create("org.gnome.desktop.interface");
+    auto theme = settings->get_string("icon-theme");
+    if (!theme.empty())
+      return theme;
+  }
+
+  return "hicolor";
+}
+
+/* All XDG icon directories of the current theme, its parents and the
+ * fallback themes, scanned once so that looking up an icon by name never
+ * touches the filesystem. The index is cached on disk and reused as long as
+ * none of the directories it was built from has been modified. */
+class IconThemeIndex {
+  enum class DirectoryType : uint8_t { Fixed, Scalable, Threshold, Unthemed };
+
+  struct Directory {
+    std::string path;
+    int64_t mtime;
+    DirectoryType type;
+    int size, min_size, max_size, threshold, scale;
+    uint32_t theme;
+
+    bool matches_size(int icon_size, int icon_scale) const {
+      if (scale != icon_scale)
+        return false;
+
+      switch (type) {
+      case DirectoryType::Fixed:
+        return size == icon_size;
+      case DirectoryType::Scalable:
+        return min_size <= icon_size && icon_size <= max_size;
+      case DirectoryType::Threshold:
+        return size - threshold <= icon_size && icon_size <= size + threshold;
+      case DirectoryType::Unthemed:
+        return false;
+      }
+
+      return false;
+    }
+
+    int size_distance(int icon_size, int icon_scale) const {
+      int target = icon_size * icon_scale;
+      switch (type) {
+      case DirectoryType::Fixed:
+      case DirectoryType::Unthemed:
+        return std::abs(size * scale - target);
+      case DirectoryType::Scalable:
+        if (target < min_size * scale) return min_size * scale - target;
+        if (target > max_size * scale) return target - max_size * scale;
+        return 0;
+      case DirectoryType::Threshold:
+        if (target < (size - threshold) * scale)
+          return (size - threshold) * scale - target;
+        if (target > (size + threshold) * scale)
+          return target - (size + threshold) * scale;
+        return 0;
+      }
+
+      return 0;
+    }
+  };
+
+  struct Location {
+    uint32_t directory;
+    uint8_t extension;
+  };
+
+  /* Files whose modification time is part of the cache key, in addition to
+   * the icon directories themselves. */
+  std::vector<std::pair<std::string, int64_t>> dependencies;
+  std::vector<std::string> themes;
+  std::vector<Directory> directories;
+
+  /* Locations of each icon are stored contiguously, ordered by directory,
+   * which is itself ordered by theme preference. */
+  std::unordered_map<std::string, std::pair<uint32_t, uint32_t>> icons;
+  std::vector<Location> locations;
+
+  std::unordered_map<std::string, uint32_t> directory_ids;
+
+  static constexpr const char *CACHE_HEADER = "launcher-openvr-overlay-icons 1";
+
+public:
+  static IconThemeIndex load_or_build() {
+    std::string theme = current_icon_theme();
+
+    IconThemeIndex index;
+    if (index.load(cache_path(), theme))
+      return index;
+
+    index = build(theme);
+    index.save(cache_path());
+    return index;
+  }
+
+  static IconThemeIndex build(const std::string &theme) {
+    IconThemeIndex index;
+    auto base_dirs = icon_base_dirs();
+    auto pixmap_dirs = pixmap_base_dirs();
+
+    for (const auto &base : base_dirs)
+      index.dependencies.emplace_back(base, file_mtime(base));
+
+    std::vector<std::string> pending = {theme};
+    for (auto fallback = FALLBACK_THEMES; *fallback; fallback++)
+      pending.push_back(*fallback);
+    pending.push_back("hicolor");
+
+    std::unordered_set<std::string> seen;
+    for (size_t i = 0; i < pending.size(); i++) {
+      if (!seen.insert(pending[i]).second)
+        continue;
+
+      auto parents = index.add_theme(base_dirs, pending[i]);
+      pending.insert(pending.begin() + i + 1, parents.begin(), parents.end());
+    }
+
+    for (const auto &base : pixmap_dirs)
+      index.add_directory(base, DirectoryType::Unthemed, 0, 0, 0, 0, 1);
+
+    index.scan();
+    return index;
+  }
+
+  std::optional<std::string> lookup(const std::string &name, int size,
+                                    int scale = 1) const {
+    auto it = icons.find(name);
+    if (it == icons.end())
+      return std::nullopt;
+
+    auto begin = locations.begin() + it->second.first;
+    auto end = begin + it->second.second;
+
+    /* Only the first theme that provides the icon is considered, as per the
+     * icon theme specification; unthemed directories come last. */
+    uint32_t theme = directories[begin->directory].theme;
+
+    const Location *best = nullptr;
+    int best_distance = std::numeric_limits<int>::max();
+    for (auto loc = begin; loc != end; ++loc) {
+      const Directory &dir = directories[loc->directory];
+      if (dir.theme != theme)
+        break;
+
+      if (dir.matches_size(size, scale)) {
+        best = &*loc;
+        break;
+      }
+
+      int distance = dir.size_distance(size, scale);
+      if (distance < best_distance) {
+        best = &*loc;
+        best_distance = distance;
+      }
+    }
+
+    const Directory &dir = directories[best->directory];
+    return dir.path + "/" + name + ICON_EXTENSIONS[best->extension];
+  }
+
+  size_t size() const { return icons.size(); }
+
+  bool has_theme(const std::string &theme) const {
+    return std::find(themes.begin(), themes.end(), theme) != themes.end();
+  }
+
+  bool is_icon_directory(const std::string &dir) const {
+    return directory_ids.contains(dir);
+  }
+
+  /* Directories to watch for changes: the icon directories themselves, and
+   * the ones where index.theme files or new themes may appear. */
+  std::vector<std::string> watched_directories() const {
+    std::vector<std::string> dirs;
+    for (const auto &dir : directories)
+      dirs.push_back(dir.path);
+
+    for (const auto &[file, mtime] : dependencies) {
+      if (file.ends_with("/index.theme")) {
+        if (mtime != -1)
+          dirs.push_back(std::filesystem::path(file).parent_path());
+      }
+      else
+        dirs.push_back(file);
+    }
+
+    return dirs;
+  }
+
+  /* Updates the locations of a single icon after one of its files was
+   * added or removed. This checks every directory, but only for that name. */
+  void refresh(const std::string &name) {
+    std::vector<Location> found;
+    for (uint32_t i = 0; i < directories.size(); i++) {
+      for (uint8_t ext = 0; ext < std::size(ICON_EXTENSIONS); ext++) {
+        auto path = directories[i].path + "/" + name + ICON_EXTENSIONS[ext];
+        if (access(path.c_str(), F_OK) == 0) {
+          found.push_back(Location{i, ext});
+          break;
+        }
+      }
+    }
+
+    if (found.empty()) {
+      icons.erase(name);
+      return;
+    }
+
+    /* The previous range is left unused in the location table; it is
+     * reclaimed the next time the index is built. */
+    icons[name] = std::make_pair((uint32_t)locations.size(),
+                                 (uint32_t)found.size());
+    locations.insert(locations.end(), found.begin(), found.end());
+  }
+
+private:
+  static std::string cache_path() {
+    return Glib::build_filename(
+      Glib::get_user_cache_dir(),
+      Glib::build_filename("launcher-openvr-overlay", "icon-theme-index"));
+  }
+
+  static std::vector<std::string> icon_base_dirs() {
+    std::vector<std::string> dirs = {
+      Glib::build_filename(Glib::get_home_dir(), ".icons"),
+      Glib::build_filename(Glib::get_user_data_dir(), "icons"),
+    };
+
+    for (const auto &data_dir : Glib::get_system_data_dirs())
+      dirs.push_back(Glib::build_filename(data_dir, "icons"));
+
+    return dirs;
+  }
+
+  static std::vector<std::string> pixmap_base_dirs() {
+    std::vector<std::string> dirs;
+    for (const auto &data_dir : Glib::get_system_data_dirs())
+      dirs.push_back(Glib::build_filename(data_dir, "pixmaps"));
+
+    return dirs;
+  }
+
+  /* Registers the directories of a theme and returns its parents. */
+  std::vector<std::string> add_theme(const std::vector<std::string> &base_dirs,
+                                     const std::string &theme) {
+    themes.push_back(theme);
+
+    std::optional<std::string> index_path;
+    for (const auto &base : base_dirs) {
+      auto path = Glib::build_filename(base, theme);
+      auto index_file = Glib::build_filename(path, "index.theme");
+
+      int64_t mtime = file_mtime(index_file);
+      dependencies.emplace_back(index_file, mtime);
+      if (mtime != -1 && !index_path)
+        index_path = index_file;
+    }
+
+    if (!index_path)
+      return {};
+
+    auto keys = Glib::KeyFile::create();
+    std::vector<std::string> parents;
+    try {
+      keys->load_from_file(*index_path);
+
+      std::vector<Glib::ustring> subdirs =
+        keys->get_string_list("Icon Theme", "Directories");
+      if (keys->has_key("Icon Theme", "ScaledDirectories")) {
+        for (auto &dir : keys->get_string_list("Icon Theme",
+                                               "ScaledDirectories"))
+          subdirs.push_back(dir);
+      }
+
+      for (const auto &subdir : subdirs) {
+        if (!keys->has_group(subdir) || !keys->has_key(subdir, "Size"))
+          continue;
+
+        auto int_key = [&](const char *key, int default_value) {
+          return keys->has_key(subdir, key) ?
+            keys->get_integer(subdir, key) : default_value;
+        };
+
+        int size = keys->get_integer(subdir, "Size");
+        DirectoryType type = DirectoryType::Threshold;
+        if (keys->has_key(subdir, "Type")) {
+          auto type_name = keys->get_string(subdir, "Type");
+          if (type_name == "Fixed") type = DirectoryType::Fixed;
+          else if (type_name == "Scalable") type = DirectoryType::Scalable;
+        }
+
+        for (const auto &base : base_dirs) {
+          add_directory(Glib::build_filename(base,
+                                             Glib::build_filename(theme,
+                                                                  subdir)),
+                        type, size, int_key("MinSize", size),
+                        int_key("MaxSize", size), int_key("Threshold", 2),
+                        int_key("Scale", 1));
+        }
+      }
+
+      if (keys->has_key("Icon Theme", "Inherits")) {
+        for (auto &parent : keys->get_string_list("Icon Theme", "Inherits"))
+          parents.push_back(parent);
+      }
+    } catch (const Glib::Error &e) {}
+
+    return parents;
+  }
+
+  void add_directory(std::string path, DirectoryType type, int size,
+                     int min_size, int max_size, int threshold, int scale) {
+    int64_t mtime = file_mtime(path);
+    if (mtime == -1)
+      return;
+
+    directories.push_back(Directory{
+        std::move(path), mtime, type, size, min_size, max_size, threshold,
+        scale,
+        type == DirectoryType::Unthemed ? (uint32_t)-1
+                                        : (uint32_t)themes.size() - 1});
+  }
+
+  void scan() {
+    std::vector<std::vector<std::pair<std::string, uint8_t>>> contents(
+      directories.size());
+
+    tbb::parallel_for(size_t(0), directories.size(), [&](size_t i) {
+      std::error_code error;
+      for (const auto &entry :
+             std::filesystem::directory_iterator(directories[i].path, error)) {
+        auto filename = entry.path().filename().string();
+        for (uint8_t ext = 0; ext < std::size(ICON_EXTENSIONS); ext++) {
+          if (filename.ends_with(ICON_EXTENSIONS[ext])) {
+            filename.resize(filename.size() - strlen(ICON_EXTENSIONS[ext]));
+            contents[i].emplace_back(std::move(filename), ext);
+            break;
+          }
+        }
+      }
+
+      /* Within a directory, prefer PNG over SVG over XPM. */
+      std::sort(contents[i].begin(), contents[i].end(),
+                [](const auto &a, const auto &b) { return a.second < b.second; });
+    });
+
+    std::unordered_map<std::string, std::vector<Location>> by_name;
+    for (size_t i = 0; i < directories.size(); i++) {
+      for (auto &[name, ext] : contents[i]) {
+        auto &name_locations = by_name[name];
+        if (name_locations.empty() ||
+            name_locations.back().directory != i)
+          name_locations.push_back(Location{(uint32_t)i, ext});
+      }
+    }
+
+    set_locations(std::move(by_name));
+  }
+
+  void set_locations(
+    std::unordered_map<std::string, std::vector<Location>> &&by_name) {
+    icons.clear();
+    locations.clear();
+    icons.reserve(by_name.size());
+
+    directory_ids.clear();
+    for (uint32_t i = 0; i < directories.size(); i++)
+      directory_ids.emplace(directories[i].path, i);
+
+    for (auto &[name, name_locations] : by_name) {
+      icons.emplace(name, std::make_pair((uint32_t)locations.size(),
+                                         (uint32_t)name_locations.size()));
+      locations.insert(locations.end(), name_locations.begin(),
+                       name_locations.end());
+    }
+  }
+
+  bool load(const std::string &path, const std::string &theme) {
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line) || line != CACHE_HEADER)
+      return false;
+
+    if (!std::getline(in, line) || line != theme)
+      return false;
+
+    size_t count;
+    in >> count;
+    std::getline(in, line);
+    for (size_t i = 0; i < count && std::getline(in, line); i++) {
+      auto tab = line.find('\t');
+      if (tab == std::string::npos) return false;
+
+      char *end;
+      int64_t mtime = strtoll(line.c_str(), &end, 10);
+      if (end == line.c_str() || end != line.c_str() + tab) return false;
+
+      auto file = line.substr(tab + 1);
+      if (file_mtime(file) != mtime) return false;
+      dependencies.emplace_back(std::move(file), mtime);
+    }
+
+    in >> count;
+    std::getline(in, line);
+    for (size_t i = 0; i < count && std::getline(in, line); i++)
+      themes.push_back(line);
+
+    in >> count;
+    std::getline(in, line);
+    for (size_t i = 0; i < count; i++) {
+      Directory dir;
+      int type;
+      in >> dir.mtime >> type >> dir.size >> dir.min_size >> dir.max_size >>
+        dir.threshold >> dir.scale >> dir.theme;
+      in.get();
+      std::getline(in, dir.path);
+      dir.type = (DirectoryType)type;
+
+      if (!in || file_mtime(dir.path) != dir.mtime) return false;
+      directories.push_back(std::move(dir));
+    }
+
+    std::unordered_map<std::string, std::vector<Location>> by_name;
+    in >> count;
+    std::getline(in, line);
+    for (size_t i = 0; i < count && std::getline(in, line); i++) {
+      auto tab = line.find('\t');
+      if (tab == std::string::npos) return false;
+
+      auto &name_locations = by_name[line.substr(0, tab)];
+      const char *cursor = line.c_str() + tab + 1;
+      char *end;
+      while (*cursor) {
+        uint32_t dir = strtoul(cursor, &end, 10);
+        if (*end != ':' || dir >= directories.size()) return false;
+        uint8_t ext = strtoul(end + 1, &end, 10);
+        if (ext >= std::size(ICON_EXTENSIONS)) return false;
+        name_locations.push_back(Location{dir, ext});
+        cursor = *end ? end + 1 : end;
+      }
+    }
+
+    if (!in) return false;
+
+    set_locations(std::move(by_name));
+    return true;
+  }
+
+  void save(const std::string &path) const {
+    std::error_code error;
+    std::filesystem::create_directories(
+      std::filesystem::path(path).parent_path(), error);
+
+    std::string tmp_path = path + ".tmp";
+    {
+      std::ofstream out(tmp_path);
+      out << CACHE_HEADER << "\n" << themes.front() << "\n";
+
+      out << dependencies.size() << "\n";
+      for (const auto &[file, mtime] : dependencies)
+        out << mtime << "\t" << file << "\n";
+
+      out << themes.size() << "\n";
+      for (const auto &theme : themes)
+        out << theme << "\n";
+
+      out << directories.size() << "\n";
+      for (const auto &dir : directories) {
+        out << dir.mtime << " " << (int)dir.type << " " << dir.size << " "
+            << dir.min_size << " " << dir.max_size << " " << dir.threshold
+            << " " << dir.scale << " " << dir.theme << " " << dir.path << "\n";
+      }
+
+      out << icons.size() << "\n";
+      for (const auto &[name, range] : icons) {
+        out << name << "\t";
+        for (uint32_t i = 0; i < range.second; i++) {
+          const Location &loc = locations[range.first + i];
+          out << (i == 0 ? "" : " ") << loc.directory << ":"
+              << (int)loc.extension;
+        }
+        out << "\n";
+      }
+
+      if (!out) return;
+    }
+
+    std::filesystem::rename(tmp_path, path, error);
+  }
+};
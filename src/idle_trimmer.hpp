@@ -0,0 +1,70 @@
+#pragma once
+
+#include "file_browser.hpp"
+#include "icon_fetcher.hpp"
+#include "memory_ledger.hpp"
+#include "ping_pong_renderer.hpp"
+#include "texture_pool.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <malloc.h>
+#include <optional>
+
+struct IdleTrimStats {
+  uint64_t trims = 0;
+  int64_t last_freed_bytes = 0;
+};
+
+/* Gives memory back while the dashboard is hidden, so that it can go to the
+ * game being played instead. Once the overlay has been hidden for the grace
+ * period, the render targets are freed, textures are evicted down to a small
+ * working set and the heap is trimmed. Everything comes back from the caches
+ * when the overlay is shown again. */
+class IdleTrimmer {
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr auto GRACE_PERIOD = std::chrono::seconds(30);
+  static constexpr size_t WORKING_SET = 16 * 1024 * 1024;
+
+  std::optional<Clock::time_point> hidden_since;
+  bool trimmed = false;
+  IdleTrimStats stats;
+
+public:
+  /* Called once per frame, before anything is drawn. */
+  void update(bool shown, PingPongRenderer &renderer, IconFetcher &icons,
+              FileBrowser &file_browser) {
+    if (shown) {
+      hidden_since.reset();
+      if (trimmed) {
+        renderer.restore();
+        TexturePool::get().set_free_limit(FreeLimitOwner::IdleTrimmer,
+                                          TexturePool::DEFAULT_FREE_LIMIT);
+        trimmed = false;
+      }
+      return;
+    }
+
+    if (!hidden_since)
+      hidden_since = Clock::now();
+
+    if (!trimmed && Clock::now() - *hidden_since >= GRACE_PERIOD) {
+      int64_t before = resident_memory();
+
+      renderer.release();
+      icons.trim(WORKING_SET);
+      file_browser.shrink();
+      TexturePool::get().set_free_limit(FreeLimitOwner::IdleTrimmer, 0);
+      malloc_trim(0);
+
+      stats.trims++;
+      stats.last_freed_bytes = before - (int64_t)resident_memory();
+      trimmed = true;
+    }
+  }
+
+  bool is_trimmed() const { return trimmed; }
+
+  IdleTrimStats get_stats() const { return stats; }
+};
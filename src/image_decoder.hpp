@@ -0,0 +1,287 @@
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
+
+#ifdef HAVE_LIBJPEG
+#include <cstdio>
+#include <jpeglib.h>
+#endif
+
+#ifdef HAVE_LIBRSVG
+#include <cairo.h>
+#include <librsvg/rsvg.h>
+#endif
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+/* Decoders write 8-bit RGBA pixels into memory obtained from the allocator,
+ * which receives the image size once the header has been parsed. This lets
+ * the caller decode straight into its final buffer.
+ *
+ * Vector images are rendered to fit in a square of the requested size, or at
+ * their own size when it is 0; bitmaps are always decoded at full size. */
+using PixelAllocator = std::function<uint8_t*(size_t width, size_t height)>;
+
+static constexpr size_t MAX_IMAGE_SIZE = 8192;
+
+class ImageDecoder {
+public:
+  virtual ~ImageDecoder() = default;
+
+  virtual const char *name() const = 0;
+  virtual bool accepts(std::span<const uint8_t> data) const = 0;
+  virtual bool decode(std::span<const uint8_t> data, size_t size,
+                      const PixelAllocator &allocate) const = 0;
+};
+
+class StbDecoder : public ImageDecoder {
+public:
+  const char *name() const override { return "stb_image"; }
+
+  bool accepts(std::span<const uint8_t> data) const override {
+    int w, h, comp;
+    return stbi_info_from_memory(data.data(), data.size(), &w, &h, &comp);
+  }
+
+  bool decode(std::span<const uint8_t> data, size_t,
+              const PixelAllocator &allocate) const override {
+    int w, h, comp;
+    stbi_uc *pixels = stbi_load_from_memory(data.data(), data.size(),
+                                            &w, &h, &comp, 4);
+    if (!pixels)
+      return false;
+
+    /* stb_image always allocates its own buffer, hence the copy. */
+    uint8_t *out = allocate(w, h);
+    memcpy(out, pixels, (size_t)w * h * 4);
+    stbi_image_free(pixels);
+
+    return true;
+  }
+};
+
+#ifdef HAVE_LIBPNG
+/* libpng uses its SSE/NEON row filters on its own when it was built with
+ * them, after checking the CPU at runtime. */
+class PngDecoder : public ImageDecoder {
+public:
+  const char *name() const override { return "libpng"; }
+
+  bool accepts(std::span<const uint8_t> data) const override {
+    return data.size() >= 8 && png_sig_cmp(data.data(), 0, 8) == 0;
+  }
+
+  bool decode(std::span<const uint8_t> data, size_t,
+              const PixelAllocator &allocate) const override {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+
+    if (!png_image_begin_read_from_memory(&image, data.data(), data.size()))
+      return false;
+
+    if (image.width > MAX_IMAGE_SIZE || image.height > MAX_IMAGE_SIZE) {
+      png_image_free(&image);
+      return false;
+    }
+
+    image.format = PNG_FORMAT_RGBA;
+    uint8_t *out = allocate(image.width, image.height);
+    return png_image_finish_read(&image, nullptr, out, 0, nullptr);
+  }
+};
+#endif
+
+#if defined(HAVE_LIBJPEG) && defined(JCS_EXTENSIONS)
+/* Relies on libjpeg-turbo for RGBA output; it selects its SIMD code paths
+ * at runtime. */
+class JpegDecoder : public ImageDecoder {
+  struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+  };
+
+  static void on_error(j_common_ptr info) {
+    longjmp(((ErrorManager*)info->err)->jump, 1);
+  }
+
+public:
+  const char *name() const override { return "libjpeg-turbo"; }
+
+  bool accepts(std::span<const uint8_t> data) const override {
+    return data.size() >= 3 &&
+      data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+  }
+
+  bool decode(std::span<const uint8_t> data, size_t,
+              const PixelAllocator &allocate) const override {
+    jpeg_decompress_struct info;
+    ErrorManager error;
+
+    info.err = jpeg_std_error(&error.pub);
+    error.pub.error_exit = on_error;
+
+    if (setjmp(error.jump)) {
+      jpeg_destroy_decompress(&info);
+      return false;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, data.data(), data.size());
+
+    if (jpeg_read_header(&info, TRUE) != JPEG_HEADER_OK ||
+        info.image_width > MAX_IMAGE_SIZE ||
+        info.image_height > MAX_IMAGE_SIZE) {
+      jpeg_destroy_decompress(&info);
+      return false;
+    }
+
+    info.out_color_space = JCS_EXT_RGBA;
+    jpeg_start_decompress(&info);
+
+    uint8_t *out = allocate(info.output_width, info.output_height);
+    size_t stride = (size_t)info.output_width * 4;
+    while (info.output_scanline < info.output_height) {
+      JSAMPROW row = out + info.output_scanline * stride;
+      jpeg_read_scanlines(&info, &row, 1);
+    }
+
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+  }
+};
+#endif
+
+#ifdef HAVE_LIBRSVG
+class SvgDecoder : public ImageDecoder {
+  static constexpr size_t DEFAULT_SIZE = 256;
+
+public:
+  const char *name() const override { return "librsvg"; }
+
+  bool accepts(std::span<const uint8_t> data) const override {
+    if (data.size() >= 2 && data[0] == 0x1F && data[1] == 0x8B)
+      return true; /* svgz */
+
+    std::string_view head((const char*)data.data(),
+                          std::min<size_t>(data.size(), 4096));
+    return head.find("<svg") != std::string_view::npos;
+  }
+
+  bool decode(std::span<const uint8_t> data, size_t size,
+              const PixelAllocator &allocate) const override {
+    RsvgHandle *handle = rsvg_handle_new_from_data(data.data(), data.size(),
+                                                   nullptr);
+    if (!handle)
+      return false;
+
+    if (size == 0) {
+      double w, h;
+      if (rsvg_handle_get_intrinsic_size_in_pixels(handle, &w, &h))
+        size = std::ceil(std::max(w, h));
+      if (size == 0 || size > MAX_IMAGE_SIZE)
+        size = DEFAULT_SIZE;
+    }
+    size = std::min(size, MAX_IMAGE_SIZE);
+
+    cairo_surface_t *surface =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
+    cairo_t *cr = cairo_create(surface);
+
+    RsvgRectangle viewport = {0, 0, (double)size, (double)size};
+    bool rendered = rsvg_handle_render_document(handle, cr, &viewport,
+                                                nullptr);
+    cairo_destroy(cr);
+    g_object_unref(handle);
+
+    if (rendered) {
+      cairo_surface_flush(surface);
+      const uint8_t *pixels = cairo_image_surface_get_data(surface);
+      size_t stride = cairo_image_surface_get_stride(surface);
+
+      /* Cairo stores premultiplied, native-endian ARGB words. */
+      uint8_t *out = allocate(size, size);
+      for (size_t y = 0; y < size; y++) {
+        const uint32_t *row = (const uint32_t*)(pixels + y * stride);
+        for (size_t x = 0; x < size; x++) {
+          uint32_t argb = row[x];
+          uint32_t a = argb >> 24;
+          uint32_t r = (argb >> 16) & 0xFF;
+          uint32_t g = (argb >> 8) & 0xFF;
+          uint32_t b = argb & 0xFF;
+          if (a != 0 && a != 255) {
+            r = (r * 255 + a / 2) / a;
+            g = (g * 255 + a / 2) / a;
+            b = (b * 255 + a / 2) / a;
+          }
+
+          uint8_t *px = out + (y * size + x) * 4;
+          px[0] = r;
+          px[1] = g;
+          px[2] = b;
+          px[3] = a;
+        }
+      }
+    }
+
+    cairo_surface_destroy(surface);
+    return rendered;
+  }
+};
+#endif
+
+/* Decoders to try in order; the accelerated ones come first and stb_image
+ * handles everything they reject. */
+static std::span<const ImageDecoder *const> image_decoders() {
+#ifdef HAVE_LIBPNG
+  static const PngDecoder png;
+#endif
+#if defined(HAVE_LIBJPEG) && defined(JCS_EXTENSIONS)
+  static const JpegDecoder jpeg;
+#endif
+#ifdef HAVE_LIBRSVG
+  static const SvgDecoder svg;
+#endif
+  static const StbDecoder stb;
+
+  static const ImageDecoder *const decoders[] = {
+#ifdef HAVE_LIBPNG
+    &png,
+#endif
+#if defined(HAVE_LIBJPEG) && defined(JCS_EXTENSIONS)
+    &jpeg,
+#endif
+#ifdef HAVE_LIBRSVG
+    &svg,
+#endif
+    &stb,
+  };
+
+  return decoders;
+}
+
+static bool decode_image(std::span<const uint8_t> data, size_t size,
+                         const PixelAllocator &allocate) {
+  for (const ImageDecoder *decoder : image_decoders()) {
+    if (decoder->accepts(data) && decoder->decode(data, size, allocate))
+      return true;
+  }
+
+  return false;
+}
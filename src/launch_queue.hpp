@@ -0,0 +1,489 @@
+#pragma once
+
+#include "frame_scheduler.hpp"
+#include "launch_warmer.hpp"
+#include "process_supervisor.hpp"
+#include "spawn_helper.hpp"
+#include "thread_role.hpp"
+#include "xlib_errors.hpp"
+
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <giomm.h>
+#include <memory>
+#include <mutex>
+#include <openvr.h>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/* Who would define C as 1? */
+#ifdef C
+#undef C
+#endif
+
+#include <tbb/concurrent_queue.h>
+
+enum class LaunchState {
+  Queued, Spawned, Ready, Failed,
+};
+
+static const char *const LAUNCH_STATE_NAMES[] = {
+  "queued", "spawned", "ready", "failed",
+};
+
+struct LaunchStatus {
+  using Clock = std::chrono::steady_clock;
+
+  uint64_t id;
+  std::string key; /* What the launch is shown on, e.g. a desktop id. */
+  std::string label;
+  LaunchState state = LaunchState::Queued;
+  std::string error;
+
+  /* 0 when Gio starts the application, since it does not report it. */
+  pid_t pid = 0;
+
+  Clock::time_point queued, spawned, ready;
+
+  double spawn_ms() const {
+    return std::chrono::duration<double, std::milli>(spawned - queued).count();
+  }
+
+  double ready_ms() const {
+    return std::chrono::duration<double, std::milli>(ready - queued).count();
+  }
+};
+
+/* Overlay key given to vr-video-player on its command line. */
+static std::string overlay_key_argument(const std::vector<std::string> &argv) {
+  auto it = std::find(argv.begin(), argv.end(), "--overlay-key");
+  if (it == argv.end() || it + 1 == argv.end())
+    return {};
+  return *(it + 1);
+}
+
+/* Arguments of the Exec line of a desktop entry, with its field codes
+ * expanded. No file or URL is ever passed. */
+static std::vector<std::string> exec_arguments(const std::string &exec,
+                                               const std::string &name,
+                                               const std::string &icon,
+                                               const std::string &path) {
+  std::vector<std::string> args;
+  for (const std::string &arg : Glib::shell_parse_argv(exec)) {
+    if (arg == "%f" || arg == "%F" || arg == "%u" || arg == "%U")
+      continue;
+
+    if (arg == "%i") {
+      if (!icon.empty()) {
+        args.push_back("--icon");
+        args.push_back(icon);
+      }
+      continue;
+    }
+
+    std::string expanded;
+    for (size_t i = 0; i < arg.size(); i++) {
+      if (arg[i] != '%' || i + 1 == arg.size()) {
+        expanded.push_back(arg[i]);
+        continue;
+      }
+
+      switch (arg[++i]) {
+      case '%': expanded.push_back('%'); break;
+      case 'c': expanded += name; break;
+      case 'k': expanded += path; break;
+      default: break; /* Deprecated or misplaced codes are dropped. */
+      }
+    }
+
+    args.push_back(std::move(expanded));
+  }
+
+  return args;
+}
+
+/* Starts applications on a worker thread, so that the render thread never
+ * waits for them. Programs are started by the spawn helper; only
+ * applications that run in a terminal or through D-Bus activation are left
+ * to Gio.
+ *
+ * Once started, a launch is ready when its overlay exists, or when a new
+ * window shows up. The window has to belong to a process of the tree
+ * started by the launch, which covers wrappers such as env or sh -c, and
+ * Flatpak applications whose windows carry the process id from their own
+ * namespace. The first new window is taken instead when the process is not
+ * known, since Gio does not report what it starts, or when the tree has
+ * exited, e.g. after a launcher handed the application over. Launches that
+ * never get there are left as spawned after a minute.
+ *
+ * OpenVR is only used from the render thread: overlays are looked up there
+ * by jobs posted to the frame scheduler, and the worker polls their
+ * result. */
+class LaunchQueue {
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr auto POLL_INTERVAL = std::chrono::milliseconds(100);
+  static constexpr auto READY_TIMEOUT = std::chrono::seconds(60);
+  static constexpr size_t MAX_HISTORY = 32;
+
+  struct Job {
+    uint64_t id;
+    std::string key, label;
+    LaunchCommand command;
+  };
+
+  /* Shared with the job looking the overlay up, which may outlive the
+   * launch. */
+  struct OverlayCheck {
+    std::string key;
+    std::atomic<bool> found = false, posted = false;
+  };
+
+  struct PendingLaunch {
+    uint64_t id;
+    pid_t pid;
+    std::string program;
+    std::shared_ptr<OverlayCheck> overlay;
+    Clock::time_point since;
+  };
+
+  mutable std::mutex mutex;
+  std::deque<LaunchStatus> history;
+  uint64_t next_id = 0;
+
+  /* Incremented whenever the history changes. */
+  std::atomic<uint64_t> history_generation = 0;
+
+  /* Jobs to run, or nullopt to stop the thread. */
+  tbb::concurrent_bounded_queue<std::optional<Job>> jobs;
+  SpawnHelper &spawner;
+  FrameScheduler &scheduler;
+  LaunchWarmer warmer;
+  ProcessSupervisor supervisor;
+  std::jthread worker;
+
+public:
+  LaunchQueue(SpawnHelper &spawner, FrameScheduler &scheduler):
+    spawner(spawner),
+    scheduler(scheduler),
+    supervisor([this](std::string key, std::string label,
+                      LaunchCommand command) {
+      launch(std::move(key), std::move(label), std::move(command));
+    }),
+    worker([this]() { run(); }) {}
+
+  ~LaunchQueue() {
+    jobs.push(std::nullopt);
+  }
+
+  uint64_t launch(std::string key, std::string label, LaunchCommand command) {
+    LaunchStatus status;
+    status.key = key;
+    status.label = label;
+    status.queued = Clock::now();
+
+    uint64_t id;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      id = status.id = next_id++;
+      history.push_back(std::move(status));
+      if (history.size() > MAX_HISTORY)
+        history.pop_front();
+      history_generation++;
+    }
+
+    jobs.push(Job{id, std::move(key), std::move(label), std::move(command)});
+    return id;
+  }
+
+  /* Prepares for a launch of a program, when what would launch it is
+   * hovered. Only called from the render thread. */
+  void warm(const std::string &program) {
+    warmer.warm(program);
+  }
+
+  /* Processes started by launches, and what they use. */
+  ProcessSupervisor &processes() {
+    return supervisor;
+  }
+
+  /* Changes whenever what recent returns does, so that it can be called
+   * only then. */
+  uint64_t generation() const {
+    return history_generation;
+  }
+
+  /* Latest launches, oldest first. */
+  std::vector<LaunchStatus> recent() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::vector<LaunchStatus>(history.begin(), history.end());
+  }
+
+private:
+  template <typename F>
+  void update_status(uint64_t id, F f) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (LaunchStatus &status : history) {
+      if (status.id == id) {
+        f(status);
+        history_generation++;
+        break;
+      }
+    }
+  }
+
+  /* Windows may disappear while they are being looked at: the error handler
+   * installed by init_xlib ignores BadWindow errors. */
+  void run() {
+    set_thread_role(ThreadRole::InteractiveIO, "launcher");
+
+    Display *display = XOpenDisplay(nullptr);
+    std::set<Window> known_windows;
+    if (display)
+      known_windows = window_list(display);
+
+    std::vector<PendingLaunch> pending;
+    while (true) {
+      std::optional<Job> job;
+      if (pending.empty()) {
+        jobs.pop(job);
+        if (display)
+          known_windows = window_list(display);
+      }
+      else if (!jobs.try_pop(job)) {
+        std::this_thread::sleep_for(POLL_INTERVAL);
+        check_pending(display, known_windows, pending);
+        continue;
+      }
+
+      if (!job)
+        break;
+
+      if (auto launch = start(*job))
+        pending.push_back(*launch);
+    }
+
+    if (display)
+      close_display(display);
+  }
+
+  std::optional<PendingLaunch> start(Job &job) {
+    const LaunchCommand &command = job.command;
+    pid_t pid = 0;
+    int pidfd = -1;
+    std::string error;
+    std::vector<std::string> argv = command.argv;
+    std::string dir = std::filesystem::current_path();
+    std::vector<std::string> env;
+
+    try {
+      if (!command.desktop_file.empty()) {
+        auto app = Gio::DesktopAppInfo::create_from_filename(
+          command.desktop_file);
+        if (!app)
+          error = "could not load " + command.desktop_file;
+        else if (app->get_boolean("Terminal") ||
+                 app->get_boolean("DBusActivatable")) {
+          if (!app->launch(nullptr, nullptr))
+            error = "could not launch " + command.desktop_file;
+        }
+        else {
+          argv = exec_arguments(app->get_commandline(), app->get_name(),
+                                app->get_string("Icon"),
+                                command.desktop_file);
+
+          /* Like Gio, which sets no startup id without a launch context. */
+          std::string path = app->get_string("Path");
+          if (!path.empty())
+            dir = path;
+          env.push_back("GIO_LAUNCHED_DESKTOP_FILE=" + command.desktop_file);
+        }
+      }
+      else if (!command.command_line.empty())
+        argv = exec_arguments(command.command_line, job.label, "", "");
+
+      if (!argv.empty()) {
+        SpawnedProcess process = spawner.spawn(dir, argv, env);
+        pid = process.pid;
+        pidfd = process.pidfd;
+      }
+    } catch (const Glib::Error &e) {
+      error = e.what();
+    } catch (const std::system_error &e) {
+      error = e.what();
+    }
+
+    Clock::time_point now = Clock::now();
+    update_status(job.id, [&](LaunchStatus &status) {
+      status.spawned = now;
+      status.pid = pid;
+      status.state = error.empty() ? LaunchState::Spawned : LaunchState::Failed;
+      status.error = error;
+    });
+
+    if (!error.empty())
+      return std::nullopt;
+
+    if (pid != 0)
+      supervisor.track(job.id, pid, pidfd, job.key, job.label, command);
+
+    std::shared_ptr<OverlayCheck> overlay;
+    if (!command.overlay_key.empty()) {
+      overlay = std::make_shared<OverlayCheck>();
+      overlay->key = command.overlay_key;
+    }
+
+    std::string program = argv.empty() ? "" : argv[0];
+    return PendingLaunch{job.id, pid, program, std::move(overlay), now};
+  }
+
+  void check_pending(Display *display, std::set<Window> &known_windows,
+                     std::vector<PendingLaunch> &pending) {
+    std::vector<Window> new_windows;
+    if (display) {
+      std::set<Window> windows = window_list(display);
+      std::set_difference(windows.begin(), windows.end(),
+                          known_windows.begin(), known_windows.end(),
+                          std::back_inserter(new_windows));
+      known_windows = std::move(windows);
+    }
+
+    Clock::time_point now = Clock::now();
+    std::erase_if(pending, [&](const PendingLaunch &launch) {
+      bool ready = false;
+      pid_t ready_pid = launch.pid;
+      if (launch.overlay) {
+        ready = launch.overlay->found;
+        if (!ready && !launch.overlay->posted.exchange(true))
+          post_overlay_check(launch.overlay);
+      }
+      else if (!new_windows.empty()) {
+        std::optional<std::unordered_map<pid_t, pid_t>> tree;
+        if (launch.pid != 0) {
+          if (auto pids = supervisor.tree(launch.id))
+            tree = namespace_pids(*pids);
+        }
+
+        /* Each new window is only given to one launch. */
+        for (auto it = new_windows.begin(); it != new_windows.end(); it++) {
+          if (tree) {
+            auto found = tree->find(window_pid(display, *it));
+            if (found == tree->end())
+              continue;
+            ready_pid = found->second;
+          }
+
+          new_windows.erase(it);
+          ready = true;
+          break;
+        }
+      }
+
+      if (ready) {
+        if (ready_pid != 0)
+          warmer.record(launch.program, ready_pid);
+
+        update_status(launch.id, [&](LaunchStatus &status) {
+          status.state = LaunchState::Ready;
+          status.ready = now;
+        });
+      }
+
+      return ready || now - launch.since >= READY_TIMEOUT;
+    });
+  }
+
+  void post_overlay_check(std::shared_ptr<OverlayCheck> overlay) {
+    scheduler.post(JobPriority::Low, [overlay = std::move(overlay)]() {
+      vr::VROverlayHandle_t handle;
+      overlay->found = vr::VROverlay() &&
+        vr::VROverlay()->FindOverlay(overlay->key.c_str(), &handle) ==
+          vr::VROverlayError_None;
+      overlay->posted = false;
+    });
+  }
+
+  /* Process ids of a tree in each pid namespace its processes are in, e.g.
+   * that of a Flatpak sandbox, mapped to their id in ours. */
+  static std::unordered_map<pid_t, pid_t> namespace_pids(
+    const std::vector<pid_t> &tree) {
+    std::unordered_map<pid_t, pid_t> pids;
+    for (pid_t pid : tree) {
+      pids.try_emplace(pid, pid);
+
+      std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+      std::string line;
+      while (std::getline(status, line)) {
+        if (!line.starts_with("NSpid:"))
+          continue;
+
+        std::istringstream ids(line.substr(6));
+        pid_t id;
+        while (ids >> id)
+          pids.try_emplace(id, pid);
+        break;
+      }
+    }
+
+    return pids;
+  }
+
+  static std::set<Window> window_list(Display *display) {
+    Atom client_list = XInternAtom(display, "_NET_CLIENT_LIST", False);
+
+    Atom type;
+    int format;
+    unsigned long count, bytes_after;
+    unsigned char *data = nullptr;
+    if (XGetWindowProperty(display, DefaultRootWindow(display), client_list,
+                           0, 65536, False, XA_WINDOW, &type, &format,
+                           &count, &bytes_after, &data) != Success)
+      return {};
+
+    std::set<Window> windows;
+    if (data && format == 32) {
+      /* 32 bit properties are returned as arrays of long. */
+      for (unsigned long i = 0; i < count; i++)
+        windows.insert(((long*)data)[i]);
+    }
+
+    if (data)
+      XFree(data);
+
+    return windows;
+  }
+
+  static pid_t window_pid(Display *display, Window window) {
+    Atom wm_pid = XInternAtom(display, "_NET_WM_PID", False);
+
+    Atom type;
+    int format;
+    unsigned long count, bytes_after;
+    unsigned char *data = nullptr;
+    if (XGetWindowProperty(display, window, wm_pid, 0, 1, False, XA_CARDINAL,
+                           &type, &format, &count, &bytes_after,
+                           &data) != Success)
+      return 0;
+
+    pid_t pid = 0;
+    if (data && format == 32 && count == 1)
+      pid = ((long*)data)[0];
+
+    if (data)
+      XFree(data);
+
+    return pid;
+  }
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "spawn_helper.hpp"
+#include "thread_role.hpp"
+
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <giomm.h>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/* Who would define C as 1? */
+#ifdef C
+#undef C
+#endif
+
+#include <tbb/concurrent_queue.h>
+
+/* Gets programs into the page cache before they are launched.
+ *
+ * Most of the time gamescope or vr-video-player takes to show up after a
+ * cold start goes into reading its Vulkan, OpenVR and driver libraries.
+ * Neither can be started ahead of time and handed an application or a video
+ * later, so instead, the files a program had mapped the last time it was
+ * ready are remembered as its profile, and read ahead when a tile that
+ * would launch it is hovered. Programs without a profile only get their
+ * executable read.
+ *
+ * Profiles are kept in $XDG_CACHE_HOME/launcher-openvr-overlay/
+ * launch-profiles. */
+class LaunchWarmer {
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr const char *FILE_HEADER =
+    "launcher-openvr-overlay launch profiles 1";
+
+  /* Files stay cached long after being read: hovering the same tile again
+   * soon after does nothing. */
+  static constexpr auto REWARM_DELAY = std::chrono::seconds(60);
+
+  static constexpr size_t MAX_PROFILE_FILES = 1024;
+
+  /* Files to remember for a program, or nullopt to warm it. */
+  struct Job {
+    std::string program;
+    std::optional<std::vector<std::string>> files;
+  };
+
+  /* Only used by the render thread. */
+  std::unordered_map<std::string, Clock::time_point> last_warmed;
+
+  /* Only used by the worker thread. */
+  std::unordered_map<std::string, std::vector<std::string>> profiles;
+  ProgramPaths program_paths;
+  std::string path;
+
+  /* Jobs to run, or nullopt to stop the thread. */
+  tbb::concurrent_bounded_queue<std::optional<Job>> jobs;
+  std::jthread worker;
+
+public:
+  LaunchWarmer():
+    path(Glib::build_filename(
+           Glib::get_user_cache_dir(),
+           Glib::build_filename("launcher-openvr-overlay",
+                                "launch-profiles"))),
+    worker([this]() { run(); }) {}
+
+  ~LaunchWarmer() {
+    jobs.push(std::nullopt);
+  }
+
+  /* Called from the render thread, every frame a tile is hovered. */
+  void warm(const std::string &program) {
+    if (program.empty())
+      return;
+
+    Clock::time_point now = Clock::now();
+    auto [it, inserted] = last_warmed.try_emplace(program, now);
+    if (!inserted) {
+      if (now - it->second < REWARM_DELAY)
+        return;
+      it->second = now;
+    }
+
+    jobs.push(Job{program, std::nullopt});
+  }
+
+  /* Remembers what a running instance of a program has mapped. */
+  void record(const std::string &program, pid_t pid) {
+    std::vector<std::string> files = mapped_files(pid);
+    if (!program.empty() && !files.empty())
+      jobs.push(Job{program, std::move(files)});
+  }
+
+  /* Regular files mapped by a process, in the order of their addresses. */
+  static std::vector<std::string> mapped_files(pid_t pid) {
+    std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+
+    std::vector<std::string> files;
+    std::set<std::string> seen;
+    std::string line;
+    while (std::getline(maps, line) && files.size() < MAX_PROFILE_FILES) {
+      size_t start = line.find('/');
+      if (start == std::string::npos)
+        continue;
+
+      std::string file = line.substr(start);
+      if (file.ends_with(" (deleted)") || file.starts_with("/dev/") ||
+          file.starts_with("/memfd:"))
+        continue;
+
+      if (seen.insert(file).second)
+        files.push_back(std::move(file));
+    }
+
+    return files;
+  }
+
+private:
+  void run() {
+    set_thread_role(ThreadRole::InteractiveIO, "launch-warm");
+    load();
+
+    std::optional<Job> job;
+    while (true) {
+      jobs.pop(job);
+      if (!job)
+        break;
+
+      if (job->files) {
+        profiles[job->program] = std::move(*job->files);
+        save();
+      }
+      else {
+        auto it = profiles.find(job->program);
+        if (it != profiles.end())
+          read_ahead(it->second);
+        else
+          read_ahead({program_paths.resolve(job->program)});
+      }
+    }
+  }
+
+  /* Only schedules the reads: the kernel does them in the background. */
+  static void read_ahead(const std::vector<std::string> &files) {
+    for (const std::string &file : files) {
+      int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd == -1)
+        continue;
+
+      posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+      close(fd);
+    }
+  }
+
+  void load() {
+    std::ifstream in(path);
+    std::string header;
+    if (!std::getline(in, header) || header != FILE_HEADER)
+      return;
+
+    std::string line;
+    while (std::getline(in, line)) {
+      size_t tab = line.find('\t');
+      if (tab != std::string::npos)
+        profiles[line.substr(0, tab)].push_back(line.substr(tab + 1));
+    }
+  }
+
+  /* A lost profile only means a slower launch: no need to sync. */
+  void save() const {
+    std::error_code error;
+    std::filesystem::create_directories(
+      std::filesystem::path(path).parent_path(), error);
+
+    std::string tmp_path = path + ".tmp";
+    {
+      std::ofstream out(tmp_path, std::ios::trunc);
+      out << FILE_HEADER << "\n";
+      for (const auto &[program, files] : profiles) {
+        for (const std::string &file : files)
+          out << program << "\t" << file << "\n";
+      }
+
+      if (!out.flush())
+        return;
+    }
+
+    std::filesystem::rename(tmp_path, path, error);
+  }
+};
@@ -8,16 +8,27 @@
 
 #include "file_browser.hpp"
 #include "application_launcher.hpp"
+#include "debug_panel.hpp"
+#include "frame_scheduler.hpp"
 #include "icon_fetcher.hpp"
+#include "idle_trimmer.hpp"
 #include "imconfig.h"
+#include "memory_pressure.hpp"
 #include <imgui.h>
 #include <imgui_impl_opengl3.h>
 
 #include "color_theme.h"
 #include "ping_pong_renderer.hpp"
+#include "running_panel.hpp"
 #include "video_player_parameters.hpp"
 #include "source_sans_pro.h"
+#include "spawn_helper.hpp"
+#include "texture_pool.hpp"
+#include "texture_table.hpp"
+#include "texture_uploader.hpp"
+#include "thread_role.hpp"
 #include "window_monitor.hpp"
+#include "xlib_errors.hpp"
 
 #include <giomm.h>
 #include <algorithm>
@@ -37,6 +48,13 @@ static std::pair<vr::VROverlayHandle_t, vr::VROverlayHandle_t> create_overlay();
 static void ImGui_ImplOpenVR_ProcessEvent(const vr::VREvent_t &event);
 
 int main(int argc, char *argv[]) {
+  init_xlib();
+
+  /* Forked before anything else is loaded or opened. */
+  SpawnHelper spawn_helper;
+
+  set_thread_role(ThreadRole::Render, "launcher-openvr");
+  start_task_workers();
   Gio::init();
 
   SDL_Init(SDL_INIT_VIDEO);
@@ -89,14 +107,22 @@ int main(int argc, char *argv[]) {
     font_compressed_data, font_compressed_size, 48);
 
   {
-    IconFetcher icons;
+    FrameScheduler scheduler;
+    TextureTable textures;
+    TextureUploader uploader(window, context, textures);
+    IconFetcher icons(uploader, scheduler);
 
     GamescopeParameters gamescope_params;
     VideoPlayerParameters player_params;
 
-    ApplicationLauncher launcher;
-    FileBrowser file_browser;
-    WindowMonitor window_monitor(window, context);
+    LaunchQueue launches(spawn_helper, scheduler);
+    ApplicationLauncher launcher(launches);
+    FileBrowser file_browser(scheduler, launches);
+    WindowMonitor window_monitor(uploader, launches);
+    RunningPanel running_panel;
+    DebugPanel debug_panel;
+    IdleTrimmer idle_trimmer;
+    MemoryPressureMonitor memory_pressure;
 
     uint64_t prev_time = SDL_GetPerformanceCounter();
 
@@ -142,6 +168,13 @@ int main(int argc, char *argv[]) {
       prev_time = current_time;
 
       ImGui::NewFrame();
+      idle_trimmer.update(shown, renderer, icons, file_browser);
+      memory_pressure.update(icons, file_browser, window_monitor);
+      icons.begin_frame();
+      scheduler.run_jobs();
+
+      if (!shown)
+        launcher.prefetch_icons(icons);
 
       if (shown) {
         ImGuiIO &io = ImGui::GetIO();
@@ -163,12 +196,25 @@ int main(int argc, char *argv[]) {
             window_monitor.draw(player_params);
             ImGui::EndTabItem();
           }
+          else
+            window_monitor.hide();
 
           if (ImGui::BeginTabItem("Files")) {
             file_browser.draw(icons, player_params);
             ImGui::EndTabItem();
           }
 
+          if (ImGui::BeginTabItem("Running")) {
+            running_panel.draw(launches.processes());
+            ImGui::EndTabItem();
+          }
+
+          if (ImGui::BeginTabItem("Debug")) {
+            debug_panel.draw(icons, window_monitor, scheduler, idle_trimmer,
+                             memory_pressure, launches);
+            ImGui::EndTabItem();
+          }
+
           ImGui::EndTabBar();
         }
       }
@@ -201,10 +247,14 @@ int main(int argc, char *argv[]) {
         renderer.flip();
       }
 
+      TexturePool::get().end_frame();
+
       vr::VROverlay()->WaitFrameSync(20);
     }
   }
 
+  TexturePool::get().clear();
+
   ImGui_ImplOpenGL3_Shutdown();
   ImGui::DestroyContext();
 
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/* Read-only mapping of a whole file.
+ *
+ * Only for files that are never truncated while mapped, like the caches
+ * written by the overlay, which replace the previous file through a rename.
+ * Reading a page past the end of a truncated file raises SIGBUS. Other files
+ * are read with read_file. */
+class MappedFile {
+  void *data_ptr;
+  size_t data_size;
+
+public:
+  MappedFile(const std::string &path): data_ptr(MAP_FAILED), data_size(0) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      data_size = st.st_size;
+      data_ptr = mmap(nullptr, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data_ptr != MAP_FAILED)
+        madvise(data_ptr, data_size, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_ptr != MAP_FAILED)
+      munmap(data_ptr, data_size);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile &operator=(const MappedFile&) = delete;
+
+  explicit operator bool() const { return data_ptr != MAP_FAILED; }
+
+  std::span<const uint8_t> data() const {
+    if (data_ptr == MAP_FAILED) return {};
+    return {(const uint8_t*)data_ptr, data_size};
+  }
+};
+
+/* Contents of a whole file, read into memory. Unlike a mapping, this is
+ * safe if the file is truncated or rewritten meanwhile: the result is then
+ * just incomplete, which decoders and parsers reject. */
+static std::optional<std::vector<uint8_t>> read_file(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return std::nullopt;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return std::nullopt;
+  }
+
+  /* One more byte than the size, so that reaching the end of the file does
+   * not need a second call to read in the common case. */
+  std::vector<uint8_t> data(st.st_size + 1);
+  size_t size = 0;
+  while (true) {
+    if (size == data.size())
+      data.resize(data.size() * 2);
+
+    ssize_t n = read(fd, data.data() + size, data.size() - size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      close(fd);
+      return std::nullopt;
+    }
+    if (n == 0)
+      break;
+
+    size += n;
+  }
+
+  close(fd);
+  data.resize(size);
+  return data;
+}
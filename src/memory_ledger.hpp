@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <utility>
+#include <unistd.h>
+
+enum class MemoryCategory {
+  DecodedIcons,
+  Textures,
+  TextureSlack,
+  TexturePool,
+  FileEntries,
+  WindowEntries,
+  Count
+};
+
+static const char *MEMORY_CATEGORY_NAMES[] = {
+  "Decoded icons",
+  "GL textures",
+  "GL texture slack",
+  "Pooled textures",
+  "File entries",
+  "Window entries",
+};
+
+struct MemoryAccount {
+  std::atomic<int64_t> count{0};
+  std::atomic<int64_t> bytes{0};
+};
+
+static size_t resident_memory() {
+  std::ifstream statm("/proc/self/statm");
+  size_t total_pages = 0, resident_pages = 0;
+  statm >> total_pages >> resident_pages;
+  return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+static double to_mib(int64_t bytes) {
+  return bytes / (1024.0 * 1024.0);
+}
+
+/* Process-wide count of objects and bytes held by each cache. */
+struct MemoryLedger {
+  static MemoryAccount &get(MemoryCategory category) {
+    static std::array<MemoryAccount, (size_t)MemoryCategory::Count> accounts;
+    return accounts[(size_t)category];
+  }
+};
+
+/* Charges a number of bytes to a category for as long as it is alive. Meant
+ * to be embedded in the object that owns the memory: copies charge the
+ * bytes again and moves transfer them. */
+class MemoryCharge {
+  MemoryCategory category;
+  size_t bytes;
+  bool active;
+
+  void add() {
+    auto &account = MemoryLedger::get(category);
+    account.count.fetch_add(1, std::memory_order_relaxed);
+    account.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void remove() {
+    if (!active) return;
+    auto &account = MemoryLedger::get(category);
+    account.count.fetch_sub(1, std::memory_order_relaxed);
+    account.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+public:
+  MemoryCharge(MemoryCategory category, size_t bytes):
+    category(category), bytes(bytes), active(true)
+    { add(); }
+
+  MemoryCharge(const MemoryCharge &other):
+    category(other.category), bytes(other.bytes), active(other.active)
+    { if (active) add(); }
+
+  MemoryCharge(MemoryCharge &&other):
+    category(other.category), bytes(other.bytes), active(other.active)
+    { other.active = false; }
+
+  MemoryCharge &operator=(MemoryCharge other) {
+    std::swap(category, other.category);
+    std::swap(bytes, other.bytes);
+    std::swap(active, other.active);
+    return *this;
+  }
+
+  ~MemoryCharge() { remove(); }
+
+  void set(size_t new_bytes) {
+    if (active) {
+      MemoryLedger::get(category).bytes.fetch_add(
+        (int64_t)new_bytes - (int64_t)bytes, std::memory_order_relaxed);
+    }
+    bytes = new_bytes;
+  }
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "file_browser.hpp"
+#include "icon_fetcher.hpp"
+#include "texture_pool.hpp"
+#include "thread_role.hpp"
+#include "window_monitor.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <malloc.h>
+#include <poll.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+enum class MemoryPressure {
+  Normal, Moderate, Critical
+};
+
+static const char *const MEMORY_PRESSURE_NAMES[] = {
+  "normal", "moderate", "critical",
+};
+
+struct MemoryPressureAction {
+  std::chrono::steady_clock::time_point time;
+  std::string description;
+};
+
+/* Watches memory pressure through PSI (/proc/pressure/memory) and shrinks
+ * caches while the system is short on memory, so that the game keeps its
+ * memory and does not start swapping.
+ *
+ * The monitoring thread only computes the pressure level: triggers fire when
+ * tasks stalled on memory for too long during a 2 second window, and the
+ * level goes down one step after 10 seconds without triggers and with
+ * little stall time. Unprivileged processes cannot use shorter windows. If
+ * triggers are not available, the averages are polled instead.
+ *
+ * Caches are shrunk from the render thread, in update(). */
+class MemoryPressureMonitor {
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr const char *PSI_PATH = "/proc/pressure/memory";
+
+  /* Stall time per window that fires a trigger, in microseconds. */
+  static constexpr const char *SOME_TRIGGER = "some 150000 2000000";
+  static constexpr const char *FULL_TRIGGER = "full 100000 2000000";
+
+  static constexpr auto RECOVERY_DELAY = std::chrono::seconds(10);
+  static constexpr size_t MAX_ACTIONS = 32;
+
+  std::atomic<MemoryPressure> level{MemoryPressure::Normal};
+  std::atomic<double> some_avg10{0}, full_avg10{0};
+
+  MemoryPressure applied_level = MemoryPressure::Normal;
+  std::deque<MemoryPressureAction> actions;
+
+  std::jthread monitor_thread;
+
+public:
+  MemoryPressureMonitor():
+    monitor_thread([this](std::stop_token token) { monitor(token); })
+    {}
+
+  MemoryPressure current_level() const {
+    return level.load(std::memory_order_relaxed);
+  }
+
+  double some_stall() const { return some_avg10.load(); }
+  double full_stall() const { return full_avg10.load(); }
+
+  const std::deque<MemoryPressureAction> &recent_actions() const {
+    return actions;
+  }
+
+  /* Called once per frame, from the render thread. */
+  void update(IconFetcher &icons, FileBrowser &file_browser,
+              WindowMonitor &window_monitor) {
+    MemoryPressure new_level = current_level();
+    if (new_level == applied_level)
+      return;
+
+    switch (new_level) {
+    case MemoryPressure::Normal:
+      icons.set_budget_scale(1.0);
+      TexturePool::get().set_free_limit(FreeLimitOwner::MemoryPressure,
+                                        TexturePool::DEFAULT_FREE_LIMIT);
+      log("pressure gone: texture budget and pool restored");
+      break;
+
+    case MemoryPressure::Moderate:
+      icons.set_budget_scale(0.5);
+      TexturePool::get().set_free_limit(FreeLimitOwner::MemoryPressure,
+                                        TexturePool::DEFAULT_FREE_LIMIT / 4);
+      log("moderate pressure: texture budget halved, pool limited to 8 MiB");
+      break;
+
+    case MemoryPressure::Critical: {
+      icons.set_budget_scale(0.125);
+      int64_t before = resident_memory();
+
+      icons.trim(icons.get_texture_budget() / 8);
+      window_monitor.drop_textures();
+      file_browser.shrink();
+      TexturePool::get().set_free_limit(FreeLimitOwner::MemoryPressure, 0);
+      malloc_trim(0);
+
+      char description[128];
+      snprintf(description, sizeof(description),
+               "critical pressure: caches trimmed, %.1f MiB freed",
+               (before - (int64_t)resident_memory()) / (1024.0 * 1024.0));
+      log(description);
+      break;
+    }
+    }
+
+    applied_level = new_level;
+  }
+
+private:
+  void log(std::string description) {
+    actions.push_back(MemoryPressureAction{Clock::now(),
+                                           std::move(description)});
+    if (actions.size() > MAX_ACTIONS)
+      actions.pop_front();
+  }
+
+  static int open_trigger(const char *trigger) {
+    int fd = open(PSI_PATH, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+      return -1;
+
+    if (write(fd, trigger, strlen(trigger) + 1) < 0) {
+      close(fd);
+      return -1;
+    }
+
+    return fd;
+  }
+
+  /* Reads the 10 second averages, in percent of time stalled. */
+  bool read_averages(double &some, double &full) {
+    FILE *file = fopen(PSI_PATH, "re");
+    if (!file)
+      return false;
+
+    bool ok =
+      fscanf(file, "some avg10=%lf %*[^\n]\n", &some) == 1 &&
+      fscanf(file, "full avg10=%lf", &full) == 1;
+    fclose(file);
+
+    return ok;
+  }
+
+  void monitor(std::stop_token token) {
+    set_thread_role(ThreadRole::Input, "psi-monitor");
+    double some = 0, full = 0;
+    if (!read_averages(some, full))
+      return;
+
+    pollfd fds[2] = {
+      {open_trigger(SOME_TRIGGER), POLLPRI, 0},
+      {open_trigger(FULL_TRIGGER), POLLPRI, 0},
+    };
+
+    Clock::time_point last_event = Clock::now();
+    while (!token.stop_requested()) {
+      MemoryPressure new_level = level.load(std::memory_order_relaxed);
+
+      /* Negative file descriptors are ignored by poll, which then only
+       * serves as a timer. */
+      if (poll(fds, 2, 1000) > 0) {
+        if (fds[1].revents & POLLPRI)
+          new_level = MemoryPressure::Critical;
+        else if ((fds[0].revents & POLLPRI) &&
+                 new_level == MemoryPressure::Normal)
+          new_level = MemoryPressure::Moderate;
+        last_event = Clock::now();
+      }
+
+      if (read_averages(some, full)) {
+        some_avg10.store(some);
+        full_avg10.store(full);
+
+        if (full >= 5.0) {
+          new_level = MemoryPressure::Critical;
+          last_event = Clock::now();
+        }
+        else if (some >= 10.0 && new_level == MemoryPressure::Normal) {
+          new_level = MemoryPressure::Moderate;
+          last_event = Clock::now();
+        }
+        else if (new_level != MemoryPressure::Normal && some < 1.0 &&
+                 Clock::now() - last_event >= RECOVERY_DELAY) {
+          new_level = (MemoryPressure)((int)new_level - 1);
+          last_event = Clock::now();
+        }
+      }
+
+      level.store(new_level, std::memory_order_relaxed);
+    }
+
+    for (const pollfd &fd : fds) {
+      if (fd.fd != -1) close(fd.fd);
+    }
+  }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <GL/glew.h>
+#include <optional>
 #include <utility>
 
 struct RenderTarget {
@@ -44,21 +45,36 @@ struct RenderTarget {
 
 struct PingPongRenderer {
   bool current_target;
-  RenderTarget targets[2];
+  std::optional<RenderTarget> targets[2];
   size_t w, h;
 
   PingPongRenderer(size_t w, size_t h):
     current_target(false),
-    targets{RenderTarget(w, h), RenderTarget(w, h)},
-    w(w), h(h)
-    {}
+    w(w), h(h) {
+    restore();
+  }
+
+  /* Frees both targets while nothing needs to be drawn. */
+  void release() {
+    targets[0].reset();
+    targets[1].reset();
+  }
+
+  void restore() {
+    for (auto &target : targets) {
+      if (!target)
+        target.emplace(w, h);
+    }
+  }
+
+  bool is_released() const { return !targets[0]; }
 
   GLuint current_texture() {
-    return targets[current_target ? 0 : 1].tex;
+    return targets[current_target ? 0 : 1]->tex;
   }
 
   GLuint current_framebuffer() {
-    return targets[current_target ? 1 : 0].fbo;
+    return targets[current_target ? 1 : 0]->fbo;
   }
 
   void flip() {
@@ -0,0 +1,547 @@
+#pragma once
+
+#include "thread_role.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <poll.h>
+#include <set>
+#include <string>
+#include <string_view>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/* What to start. Exactly one of desktop_file, command_line and argv is
+ * set. */
+struct LaunchCommand {
+  std::string desktop_file;
+
+  /* Formatted like the Exec line of a desktop entry. */
+  std::string command_line;
+
+  /* Spawned directly. */
+  std::vector<std::string> argv;
+
+  /* VR overlay the application creates once it is up, if any. Otherwise,
+   * its first window is waited for. */
+  std::string overlay_key;
+};
+
+/* Resources used by a process and all of its descendants. */
+struct ProcessUsage {
+  size_t process_count = 0;
+  double cpu_percent = 0; /* Of one core, since the previous sample. */
+  int64_t resident_bytes = 0;
+  int64_t read_bytes = 0, write_bytes = 0; /* From the disk, in total. */
+};
+
+struct SupervisedProcess {
+  using Clock = std::chrono::steady_clock;
+
+  uint64_t id; /* Of the launch. */
+  std::string label;
+  pid_t pid;
+  bool running = true;
+
+  /* False when the process could not be given a pidfd: its pid may be
+   * reused by the time it is signaled, so it is never stopped. */
+  bool stoppable = true;
+
+  Clock::time_point started, exited;
+  ProcessUsage usage;
+
+  double uptime() const {
+    Clock::time_point end = running ? Clock::now() : exited;
+    return std::chrono::duration<double>(end - started).count();
+  }
+};
+
+/* Follows the processes started by the launcher: gamescope and what runs
+ * inside of it, vr-video-player, and applications.
+ *
+ * Each process is watched through a pidfd, which becomes readable when it
+ * exits, so that exits are noticed right away without polling. Once per
+ * second, the process and its descendants, found through
+ * /proc/<pid>/task/<tid>/children, are sampled from /proc/<pid>/stat and
+ * /proc/<pid>/io. Both happen on one background thread, waiting in poll().
+ *
+ * Processes are reaped by the spawn helper: exit statuses are not known.
+ * Signals are only sent through pidfds, each opened before checking that
+ * the process still has the start time it was sampled with, so that a
+ * reused pid is never signaled. */
+class ProcessSupervisor {
+  using Clock = std::chrono::steady_clock;
+
+public:
+  using Relaunch = std::function<void(std::string key, std::string label,
+                                      LaunchCommand command)>;
+
+private:
+  static constexpr auto SAMPLE_INTERVAL = std::chrono::seconds(1);
+
+  /* How long processes that exited stay listed. */
+  static constexpr auto EXITED_DURATION = std::chrono::seconds(30);
+
+  struct TreeProcess {
+    pid_t pid;
+    uint64_t start_time;
+  };
+
+  struct Entry {
+    SupervisedProcess process;
+    int pidfd;
+
+    std::string key;
+    LaunchCommand command;
+    bool restart = false;
+    int stop_requests = 0;
+
+    /* Processes of the tree in the latest sample. */
+    std::vector<TreeProcess> tree;
+  };
+
+  /* CPU time of a process at the previous sample. Its start time tells
+   * reused pids apart. */
+  struct CpuTime {
+    uint64_t start_time;
+    uint64_t ticks;
+  };
+
+  struct ProcessStat {
+    uint64_t start_time;
+    uint64_t ticks;
+    int64_t resident_pages;
+  };
+
+  mutable std::mutex mutex;
+  std::vector<Entry> entries;
+
+  Relaunch relaunch;
+  int wake_fd;
+
+  /* Only used by the sampling thread. */
+  std::unordered_map<pid_t, CpuTime> cpu_times;
+  Clock::time_point last_sample;
+
+  std::jthread sampler;
+
+public:
+  ProcessSupervisor(Relaunch relaunch):
+    relaunch(std::move(relaunch)),
+    wake_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+    sampler([this](std::stop_token stop) { run(stop); }) {}
+
+  ~ProcessSupervisor() {
+    sampler.request_stop();
+    wake();
+    sampler.join();
+
+    for (Entry &entry : entries) {
+      if (entry.pidfd != -1)
+        close(entry.pidfd);
+    }
+
+    if (wake_fd != -1)
+      close(wake_fd);
+  }
+
+  /* Takes ownership of pidfd, which must have been opened before the
+   * process could be reaped, or be -1. */
+  void track(uint64_t id, pid_t pid, int pidfd, std::string key,
+             std::string label, LaunchCommand command) {
+    Entry entry;
+    entry.process.id = id;
+    entry.process.label = std::move(label);
+    entry.process.pid = pid;
+    entry.process.started = Clock::now();
+    entry.pidfd = pidfd;
+    entry.process.stoppable = entry.pidfd != -1;
+    entry.key = std::move(key);
+    entry.command = std::move(command);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries.push_back(std::move(entry));
+    }
+
+    wake();
+  }
+
+  /* Running processes first, most recent first. */
+  std::vector<SupervisedProcess> processes() const {
+    std::vector<SupervisedProcess> result;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const Entry &entry : entries)
+        result.push_back(entry.process);
+    }
+
+    std::stable_sort(result.begin(), result.end(), [](const auto &a,
+                                                      const auto &b) {
+      if (a.running != b.running)
+        return a.running;
+      return a.started > b.started;
+    });
+
+    return result;
+  }
+
+  /* Processes of a launch as they are now, the root first, or nullopt once
+   * the root has exited. */
+  std::optional<std::vector<pid_t>> tree(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry *entry = find(id);
+    if (!entry || !entry->process.running || entry->pidfd == -1 ||
+        syscall(SYS_pidfd_send_signal, entry->pidfd, 0, nullptr, 0) != 0)
+      return std::nullopt;
+
+    std::vector<pid_t> pids;
+    std::set<pid_t> visited;
+    collect_tree(entry->process.pid, pids, visited);
+    return pids;
+  }
+
+  /* Asks the whole process tree to terminate the first time, and kills it
+   * after that. */
+  void stop(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (Entry *entry = find(id))
+      signal_tree(*entry, entry->stop_requests++ == 0 ? SIGTERM : SIGKILL);
+  }
+
+  /* Stops a process, and launches it again once it has exited. */
+  void restart(uint64_t id) {
+    std::optional<Entry> exited;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Entry *entry = find(id);
+      if (!entry)
+        return;
+
+      if (entry->process.running) {
+        if (!entry->process.stoppable)
+          return;
+
+        entry->restart = true;
+        signal_tree(*entry, entry->stop_requests++ == 0 ? SIGTERM : SIGKILL);
+        return;
+      }
+
+      exited = *entry;
+    }
+
+    relaunch(std::move(exited->key), std::move(exited->process.label),
+             std::move(exited->command));
+  }
+
+private:
+  Entry *find(uint64_t id) {
+    for (Entry &entry : entries) {
+      if (entry.process.id == id)
+        return &entry;
+    }
+
+    return nullptr;
+  }
+
+  /* Descendants are signaled as well, since they often live in their own
+   * process group, e.g. the application run by gamescope. The tree is
+   * walked again first, as processes may have started or exited since the
+   * latest sample. While the root is alive, its pid cannot be reused. */
+  static void signal_tree(const Entry &entry, int signal) {
+    if (!entry.process.running || entry.pidfd == -1 ||
+        syscall(SYS_pidfd_send_signal, entry.pidfd, 0, nullptr, 0) != 0)
+      return;
+
+    std::vector<pid_t> tree;
+    std::set<pid_t> visited;
+    collect_tree(entry.process.pid, tree, visited);
+
+    for (pid_t pid : tree) {
+      if (pid == entry.process.pid)
+        continue;
+
+      auto stat = read_stat(pid);
+      if (!stat)
+        continue;
+
+      auto sampled = std::find_if(entry.tree.begin(), entry.tree.end(),
+                                  [&](const TreeProcess &process) {
+                                    return process.pid == pid;
+                                  });
+      uint64_t start_time = sampled != entry.tree.end() ?
+        sampled->start_time : stat->start_time;
+      signal_process(pid, start_time, signal);
+    }
+
+    syscall(SYS_pidfd_send_signal, entry.pidfd, signal, nullptr, 0);
+  }
+
+  /* Once the pidfd is open, the pid cannot be reused: the process it
+   * refers to is the one with the expected start time, if any. */
+  static void signal_process(pid_t pid, uint64_t start_time, int signal) {
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd == -1)
+      return;
+
+    auto stat = read_stat(pid);
+    if (stat && stat->start_time == start_time)
+      syscall(SYS_pidfd_send_signal, pidfd, signal, nullptr, 0);
+
+    close(pidfd);
+  }
+
+  void wake() {
+    uint64_t value = 1;
+    if (wake_fd != -1 && write(wake_fd, &value, sizeof(value)) < 0) {
+      /* The counter is full: the thread is awake anyway. */
+    }
+  }
+
+  void run(std::stop_token stop) {
+    set_thread_role(ThreadRole::Background, "supervisor");
+
+    last_sample = Clock::now();
+    while (!stop.stop_requested()) {
+      std::vector<pollfd> fds{{wake_fd, POLLIN, 0}};
+      std::vector<uint64_t> ids{0};
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Entry &entry : entries) {
+          if (entry.process.running && entry.pidfd != -1) {
+            fds.push_back({entry.pidfd, POLLIN, 0});
+            ids.push_back(entry.process.id);
+          }
+        }
+      }
+
+      auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+        last_sample + SAMPLE_INTERVAL - Clock::now());
+      int result = poll(fds.data(), fds.size(),
+                        std::max<int64_t>(timeout.count(), 0));
+      if (result < 0 && errno != EINTR)
+        break;
+
+      if (fds[0].revents & POLLIN) {
+        uint64_t value;
+        if (read(wake_fd, &value, sizeof(value)) < 0) {
+          /* Nothing to read: another wake-up consumed it. */
+        }
+      }
+
+      std::vector<uint64_t> exited;
+      for (size_t i = 1; i < fds.size(); i++) {
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+          exited.push_back(ids[i]);
+      }
+
+      if (!exited.empty())
+        handle_exits(exited);
+
+      if (Clock::now() >= last_sample + SAMPLE_INTERVAL)
+        sample();
+    }
+  }
+
+  void handle_exits(const std::vector<uint64_t> &ids) {
+    std::vector<Entry> restarts;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Clock::time_point now = Clock::now();
+      for (uint64_t id : ids) {
+        Entry *entry = find(id);
+        if (!entry)
+          continue;
+
+        entry->process.running = false;
+        entry->process.exited = now;
+        entry->process.usage = ProcessUsage();
+        close(entry->pidfd);
+        entry->pidfd = -1;
+
+        if (entry->restart)
+          restarts.push_back(*entry);
+      }
+    }
+
+    for (Entry &entry : restarts) {
+      relaunch(std::move(entry.key), std::move(entry.process.label),
+               std::move(entry.command));
+    }
+  }
+
+  void sample() {
+    Clock::time_point now = Clock::now();
+    double elapsed = std::chrono::duration<double>(now - last_sample).count();
+    last_sample = now;
+
+    struct Root {
+      uint64_t id;
+      pid_t pid;
+      bool watched;
+    };
+
+    std::vector<Root> roots;
+    std::vector<uint64_t> gone;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::erase_if(entries, [&](const Entry &entry) {
+        return !entry.process.running &&
+          now - entry.process.exited >= EXITED_DURATION;
+      });
+
+      for (const Entry &entry : entries) {
+        if (entry.process.running) {
+          roots.push_back(Root{entry.process.id, entry.process.pid,
+                               entry.pidfd != -1});
+        }
+      }
+    }
+
+    static const double ticks_per_second = sysconf(_SC_CLK_TCK);
+
+    std::unordered_map<pid_t, CpuTime> new_cpu_times;
+    std::vector<std::pair<uint64_t, ProcessUsage>> usages;
+    std::vector<std::vector<TreeProcess>> trees;
+    for (const Root &root : roots) {
+      /* Processes watched without a pidfd are only noticed here. */
+      if (!root.watched && kill(root.pid, 0) != 0 && errno == ESRCH) {
+        gone.push_back(root.id);
+        continue;
+      }
+
+      std::vector<pid_t> pids;
+      std::set<pid_t> visited;
+      collect_tree(root.pid, pids, visited);
+
+      ProcessUsage usage;
+      uint64_t ticks = 0;
+      std::vector<TreeProcess> tree;
+      for (pid_t pid : pids) {
+        auto stat = read_stat(pid);
+        if (!stat)
+          continue;
+
+        tree.push_back(TreeProcess{pid, stat->start_time});
+
+        usage.process_count++;
+        usage.resident_bytes += stat->resident_pages * page_size();
+        read_io(pid, usage);
+
+        auto it = cpu_times.find(pid);
+        if (it != cpu_times.end() && it->second.start_time == stat->start_time)
+          ticks += stat->ticks - it->second.ticks;
+        else
+          ticks += stat->ticks;
+
+        new_cpu_times[pid] = {stat->start_time, stat->ticks};
+      }
+
+      if (elapsed > 0)
+        usage.cpu_percent = 100 * ticks / ticks_per_second / elapsed;
+
+      usages.emplace_back(root.id, usage);
+      trees.push_back(std::move(tree));
+    }
+
+    cpu_times = std::move(new_cpu_times);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t i = 0; i < usages.size(); i++) {
+        Entry *entry = find(usages[i].first);
+        if (entry && entry->process.running) {
+          entry->process.usage = usages[i].second;
+          entry->tree = std::move(trees[i]);
+        }
+      }
+    }
+
+    if (!gone.empty())
+      handle_exits(gone);
+  }
+
+  static int64_t page_size() {
+    static const int64_t size = sysconf(_SC_PAGESIZE);
+    return size;
+  }
+
+  static void collect_tree(pid_t pid, std::vector<pid_t> &tree,
+                           std::set<pid_t> &visited) {
+    if (!visited.insert(pid).second)
+      return;
+
+    tree.push_back(pid);
+
+    std::string task_dir = "/proc/" + std::to_string(pid) + "/task";
+    std::error_code error;
+    for (auto it = std::filesystem::directory_iterator(task_dir, error);
+         it != std::filesystem::directory_iterator(); it.increment(error)) {
+      if (error)
+        break;
+
+      std::ifstream children(it->path() / "children");
+      pid_t child;
+      while (children >> child)
+        collect_tree(child, tree, visited);
+    }
+  }
+
+  /* Returns nullopt for processes that are gone or zombies. */
+  static std::optional<ProcessStat> read_stat(pid_t pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(in, line))
+      return std::nullopt;
+
+    /* The command name may contain spaces and parentheses: fields are
+     * counted from the last parenthesis, which ends it. */
+    size_t end = line.rfind(')');
+    if (end == std::string::npos)
+      return std::nullopt;
+
+    std::vector<std::string_view> fields;
+    std::string_view rest = std::string_view(line).substr(end + 2);
+    while (!rest.empty()) {
+      size_t space = std::min(rest.find(' '), rest.size());
+      fields.push_back(rest.substr(0, space));
+      rest.remove_prefix(std::min(space + 1, rest.size()));
+    }
+
+    /* Field 3, the state, is the first one after the name. */
+    auto field = [&](size_t number) -> uint64_t {
+      if (number - 3 >= fields.size())
+        return 0;
+      return strtoull(std::string(fields[number - 3]).c_str(), nullptr, 10);
+    };
+
+    if (fields.empty() || fields[0] == "Z")
+      return std::nullopt;
+
+    return ProcessStat{field(22), field(14) + field(15), (int64_t)field(24)};
+  }
+
+  /* Only readable for processes of the same user. */
+  static void read_io(pid_t pid, ProcessUsage &usage) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/io");
+    std::string name;
+    int64_t value;
+    while (in >> name >> value) {
+      if (name == "read_bytes:")
+        usage.read_bytes += value;
+      else if (name == "write_bytes:")
+        usage.write_bytes += value;
+    }
+  }
+};
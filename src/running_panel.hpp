@@ -0,0 +1,86 @@
+#pragma once
+
+#include "memory_ledger.hpp"
+#include "process_supervisor.hpp"
+
+#include <imgui.h>
+
+/* Lists what the launcher started and what it costs, since the desktop
+ * cannot be seen from VR to find an application slowing the game down. */
+class RunningPanel {
+public:
+  void draw(ProcessSupervisor &supervisor) {
+    std::vector<SupervisedProcess> processes = supervisor.processes();
+    if (processes.empty()) {
+      ImGui::TextDisabled("Nothing launched is running.");
+      return;
+    }
+
+    if (!ImGui::BeginTable("running", 7))
+      return;
+
+    ImGui::TableSetupColumn("Application", ImGuiTableColumnFlags_WidthStretch,
+                            1.0);
+    ImGui::TableSetupColumn("Processes", ImGuiTableColumnFlags_WidthFixed,
+                            200);
+    ImGui::TableSetupColumn("CPU", ImGuiTableColumnFlags_WidthFixed, 150);
+    ImGui::TableSetupColumn("Memory", ImGuiTableColumnFlags_WidthFixed, 220);
+    ImGui::TableSetupColumn("Disk", ImGuiTableColumnFlags_WidthFixed, 300);
+    ImGui::TableSetupColumn("Uptime", ImGuiTableColumnFlags_WidthFixed, 180);
+    ImGui::TableSetupColumn("", ImGuiTableColumnFlags_WidthFixed, 380);
+    ImGui::TableHeadersRow();
+
+    for (const SupervisedProcess &process : processes) {
+      const ProcessUsage &usage = process.usage;
+
+      ImGui::PushID((int)process.id);
+      ImGui::TableNextRow();
+
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(process.label.c_str());
+
+      ImGui::TableNextColumn();
+      if (process.running)
+        ImGui::Text("%zu (%d)", usage.process_count, process.pid);
+      else
+        ImGui::TextDisabled("exited");
+
+      ImGui::TableNextColumn();
+      if (process.running)
+        ImGui::Text("%.0f%%", usage.cpu_percent);
+
+      ImGui::TableNextColumn();
+      if (process.running)
+        ImGui::Text("%.0f MiB", to_mib(usage.resident_bytes));
+
+      ImGui::TableNextColumn();
+      if (process.running) {
+        ImGui::Text("%.0f / %.0f MiB", to_mib(usage.read_bytes),
+                    to_mib(usage.write_bytes));
+      }
+
+      ImGui::TableNextColumn();
+      int64_t uptime = process.uptime();
+      ImGui::Text("%lld:%02lld:%02lld", (long long)uptime / 3600,
+                  (long long)uptime / 60 % 60, (long long)uptime % 60);
+
+      ImGui::TableNextColumn();
+      if (process.running && !process.stoppable)
+        ImGui::TextDisabled("cannot be stopped");
+      else {
+        if (process.running) {
+          if (ImGui::Button("Stop"))
+            supervisor.stop(process.id);
+          ImGui::SameLine();
+        }
+
+        if (ImGui::Button("Restart"))
+          supervisor.restart(process.id);
+      }
+
+      ImGui::PopID();
+    }
+
+    ImGui::EndTable();
+  }
+};
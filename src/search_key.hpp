@@ -0,0 +1,35 @@
+#pragma once
+
+#include <giomm.h>
+#include <string>
+
+/* Normalized form of a string used to match search queries: casefolded,
+ * decomposed, and without combining marks, so that "É" is matched by "e".
+ * Compatibility decomposition also turns ligatures and full-width forms into
+ * plain letters. Returns an empty key for invalid UTF-8. */
+static std::string search_key(const char *text) {
+  gchar *folded = g_utf8_casefold(text, -1);
+  gchar *decomposed = g_utf8_normalize(folded, -1, G_NORMALIZE_NFKD);
+  g_free(folded);
+
+  if (!decomposed)
+    return {};
+
+  std::string key;
+  for (const gchar *ptr = decomposed; *ptr; ptr = g_utf8_next_char(ptr)) {
+    gunichar c = g_utf8_get_char(ptr);
+    switch (g_unichar_type(c)) {
+    case G_UNICODE_NON_SPACING_MARK:
+    case G_UNICODE_SPACING_MARK:
+    case G_UNICODE_ENCLOSING_MARK:
+      break;
+    default: {
+      gchar utf8[6];
+      key.append(utf8, g_unichar_to_utf8(c, utf8));
+    }
+    }
+  }
+
+  g_free(decomposed);
+  return key;
+}
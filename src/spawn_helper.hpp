@@ -0,0 +1,387 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <poll.h>
+#include <spawn.h>
+#include <string>
+#include <string_view>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+extern char **environ;
+
+/* Full paths of programs found in PATH, so that PATH is only searched the
+ * first time a program is started. */
+class ProgramPaths {
+  std::unordered_map<std::string, std::string> paths;
+
+public:
+  const std::string &resolve(const std::string &program) {
+    auto it = paths.find(program);
+    if (it != paths.end())
+      return it->second;
+
+    std::string found = program;
+    if (program.find('/') == std::string::npos) {
+      const char *path_var = getenv("PATH");
+      std::string_view dirs = path_var ? path_var : "/usr/local/bin:/usr/bin";
+      while (!dirs.empty()) {
+        size_t end = std::min(dirs.find(':'), dirs.size());
+        std::string dir(dirs.substr(0, end));
+        dirs.remove_prefix(std::min(end + 1, dirs.size()));
+
+        std::string candidate = (dir.empty() ? "." : dir) + "/" + program;
+        if (access(candidate.c_str(), X_OK) == 0) {
+          found = std::move(candidate);
+          break;
+        }
+      }
+    }
+
+    return paths.emplace(program, std::move(found)).first->second;
+  }
+
+  /* Forgets a program which could not be started from its cached path,
+   * e.g. because it was moved. */
+  void forget(const std::string &program) {
+    paths.erase(program);
+  }
+};
+
+/* Starts a program with posix_spawn, in its own process group, with default
+ * signal handlers and no blocked signals. Variables from env, given as
+ * NAME=value, are added to the environment of this process or replace
+ * them. Returns its pid, or -errno. */
+static pid_t spawn_program(const std::string &dir,
+                           const std::vector<std::string> &env,
+                           const std::vector<std::string> &argv,
+                           ProgramPaths &program_paths) {
+  if (argv.empty())
+    return -EINVAL;
+
+  std::vector<char*> args;
+  for (const std::string &arg : argv)
+    args.push_back(const_cast<char*>(arg.c_str()));
+  args.push_back(nullptr);
+
+  std::vector<char*> envp;
+  for (const std::string &var : env)
+    envp.push_back(const_cast<char*>(var.c_str()));
+  for (char **var = environ; *var; var++) {
+    std::string_view name(*var, strcspn(*var, "="));
+    bool replaced = std::any_of(env.begin(), env.end(),
+                                [&](const std::string &other) {
+                                  return other.starts_with(name) &&
+                                    other[name.size()] == '=';
+                                });
+    if (!replaced)
+      envp.push_back(*var);
+  }
+  envp.push_back(nullptr);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (!dir.empty())
+    posix_spawn_file_actions_addchdir_np(&actions, dir.c_str());
+
+  sigset_t all_signals, no_signals;
+  sigfillset(&all_signals);
+  sigemptyset(&no_signals);
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                           POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setsigdefault(&attr, &all_signals);
+  posix_spawnattr_setsigmask(&attr, &no_signals);
+
+  pid_t pid;
+  int error = 0;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    const std::string &path = program_paths.resolve(argv[0]);
+    error = posix_spawn(&pid, path.c_str(), &actions, &attr, args.data(),
+                        envp.data());
+    if (error != ENOENT)
+      break;
+    program_paths.forget(argv[0]);
+  }
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+  return error == 0 ? pid : -error;
+}
+
+/* A started process. The caller owns its pidfd, which is -1 when the
+ * kernel does not support them. */
+struct SpawnedProcess {
+  pid_t pid;
+  int pidfd;
+};
+
+/* A small process forked at the very start of main, before the overlay
+ * connects to OpenVR, creates GL contexts, fills its caches or opens any
+ * file, which starts applications on its behalf.
+ *
+ * Forking the overlay itself means copying the page tables of hundreds of
+ * megabytes of mappings, and every descriptor not marked close-on-exec
+ * leaks into the application. The helper has neither, and children get the
+ * environment the overlay was started with. They are reaped by the
+ * helper, but only after a pidfd has been opened for them: until then
+ * their pid cannot be reused, so the pidfd always refers to the child.
+ *
+ * Requests go through a sequenced packet socket, one message each: the
+ * working directory, the variables to set in the environment, an empty
+ * field, then the arguments, separated by null bytes. The reply is the pid
+ * or an error number, with the pidfd attached. If the helper is gone,
+ * programs are started from the overlay process instead. */
+class SpawnHelper {
+  static constexpr size_t MAX_MESSAGE = 128 * 1024;
+
+  struct Reply {
+    int32_t error;
+    int32_t pid;
+  };
+
+  std::mutex mutex;
+  int fd = -1;
+  pid_t helper_pid = -1;
+  ProgramPaths program_paths;
+
+  /* Started from this process once the helper is gone, and not reaped
+   * yet. */
+  std::vector<pid_t> local_children;
+
+public:
+  SpawnHelper() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+      return;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fds[0]);
+      serve(fds[1]);
+      _exit(0);
+    }
+
+    close(fds[1]);
+    if (pid == -1) {
+      close(fds[0]);
+      return;
+    }
+
+    fd = fds[0];
+    helper_pid = pid;
+  }
+
+  /* Closing the socket stops the helper. */
+  ~SpawnHelper() {
+    if (fd != -1) {
+      close(fd);
+      waitpid(helper_pid, nullptr, 0);
+    }
+  }
+
+  SpawnHelper(const SpawnHelper&) = delete;
+  SpawnHelper &operator=(const SpawnHelper&) = delete;
+
+  /* Starts argv[0], looked up in PATH unless it contains a slash, with
+   * the NAME=value variables of env added to its environment. Throws
+   * std::system_error if it could not be started. */
+  SpawnedProcess spawn(const std::string &dir,
+                       const std::vector<std::string> &argv,
+                       const std::vector<std::string> &env = {}) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    reap_local_children();
+
+    SpawnedProcess result = fd == -1 ? spawn_locally(dir, env, argv) :
+      request(dir, env, argv);
+    if (result.pid < 0) {
+      throw std::system_error(-result.pid, std::generic_category(),
+                              argv.empty() ? "spawn" : argv[0]);
+    }
+
+    return result;
+  }
+
+private:
+  SpawnedProcess request(const std::string &dir,
+                         const std::vector<std::string> &env,
+                         const std::vector<std::string> &argv) {
+    std::string message = dir;
+    for (const std::string &var : env) {
+      message.push_back('\0');
+      message += var;
+    }
+
+    message.push_back('\0');
+    for (const std::string &arg : argv) {
+      message.push_back('\0');
+      message += arg;
+    }
+
+    if (argv.empty())
+      return SpawnedProcess{-EINVAL, -1};
+    if (message.size() > MAX_MESSAGE)
+      return SpawnedProcess{-E2BIG, -1};
+
+    Reply reply;
+    int pidfd = -1;
+    if (send(fd, message.data(), message.size(), MSG_NOSIGNAL) < 0 ||
+        !receive_reply(fd, reply, pidfd)) {
+      if (pidfd != -1)
+        close(pidfd);
+      close(fd);
+      fd = -1;
+      waitpid(helper_pid, nullptr, 0);
+      return spawn_locally(dir, env, argv);
+    }
+
+    if (reply.error)
+      return SpawnedProcess{-reply.error, -1};
+    return SpawnedProcess{reply.pid, pidfd};
+  }
+
+  /* The child is only reaped on the next call to spawn, after its pidfd
+   * has been opened. */
+  SpawnedProcess spawn_locally(const std::string &dir,
+                               const std::vector<std::string> &env,
+                               const std::vector<std::string> &argv) {
+    pid_t pid = spawn_program(dir, env, argv, program_paths);
+    if (pid < 0)
+      return SpawnedProcess{pid, -1};
+
+    local_children.push_back(pid);
+    return SpawnedProcess{pid, (int)syscall(SYS_pidfd_open, pid, 0)};
+  }
+
+  static bool receive_reply(int fd, Reply &reply, int &pidfd) {
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    iovec iov{&reply, sizeof(reply)};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t size = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (header && header->cmsg_level == SOL_SOCKET &&
+        header->cmsg_type == SCM_RIGHTS &&
+        header->cmsg_len == CMSG_LEN(sizeof(int)))
+      memcpy(&pidfd, CMSG_DATA(header), sizeof(int));
+
+    return size == sizeof(reply);
+  }
+
+  static bool send_reply(int fd, const Reply &reply, int pidfd) {
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    iovec iov{const_cast<Reply*>(&reply), sizeof(reply)};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    if (pidfd != -1) {
+      message.msg_control = control;
+      message.msg_controllen = sizeof(control);
+
+      cmsghdr *header = CMSG_FIRSTHDR(&message);
+      header->cmsg_level = SOL_SOCKET;
+      header->cmsg_type = SCM_RIGHTS;
+      header->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(header), &pidfd, sizeof(int));
+    }
+
+    return sendmsg(fd, &message, MSG_NOSIGNAL) >= 0;
+  }
+
+  void reap_local_children() {
+    std::erase_if(local_children, [](pid_t pid) {
+      return waitpid(pid, nullptr, WNOHANG) != 0;
+    });
+  }
+
+  [[noreturn]] static void serve(int fd) {
+    prctl(PR_SET_NAME, "spawn-helper");
+
+    /* Nothing but the socket and the standard streams is kept open. */
+    if (fd > 3)
+      close_range(3, fd - 1, 0);
+    close_range(fd + 1, ~0U, 0);
+
+    /* Children are reaped once they exit, which is only noticed between
+     * requests: a child cannot be reaped before its pidfd is open. */
+    sigset_t child_signal;
+    sigemptyset(&child_signal);
+    sigaddset(&child_signal, SIGCHLD);
+    signal(SIGCHLD, SIG_DFL);
+    sigprocmask(SIG_BLOCK, &child_signal, nullptr);
+    int child_fd = signalfd(-1, &child_signal, SFD_CLOEXEC | SFD_NONBLOCK);
+
+    ProgramPaths program_paths;
+    std::vector<char> buffer(MAX_MESSAGE);
+    while (true) {
+      /* Without a signalfd, children are reaped before each request. */
+      pollfd fds[2] = {{fd, POLLIN, 0}, {child_fd, POLLIN, 0}};
+      if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        _exit(0);
+
+      if (child_fd == -1 || (fds[1].revents & POLLIN)) {
+        signalfd_siginfo info;
+        while (child_fd != -1 && read(child_fd, &info, sizeof(info)) > 0) {}
+        while (waitpid(-1, nullptr, WNOHANG) > 0) {}
+      }
+
+      if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+
+      ssize_t size = recv(fd, buffer.data(), buffer.size(), 0);
+      if (size < 0 && errno == EINTR)
+        continue;
+      if (size <= 0)
+        _exit(0);
+
+      std::vector<std::string> fields;
+      const char *ptr = buffer.data(), *end = buffer.data() + size;
+      while (ptr <= end) {
+        const char *next = std::find(ptr, end, '\0');
+        fields.emplace_back(ptr, next);
+        ptr = next + 1;
+      }
+
+      /* Variables are never empty, unlike arguments. */
+      auto env_end = std::find(fields.begin() + 1, fields.end(), "");
+      std::vector<std::string> env(std::make_move_iterator(fields.begin() + 1),
+                                   std::make_move_iterator(env_end));
+      std::vector<std::string> args;
+      if (env_end != fields.end())
+        args.assign(std::make_move_iterator(env_end + 1),
+                    std::make_move_iterator(fields.end()));
+
+      pid_t pid = spawn_program(fields[0], env, args, program_paths);
+      int pidfd = pid < 0 ? -1 : syscall(SYS_pidfd_open, pid, 0);
+      Reply reply{pid < 0 ? -pid : 0, pid < 0 ? 0 : pid};
+      bool sent = send_reply(fd, reply, pidfd);
+      if (pidfd != -1)
+        close(pidfd);
+      if (!sent)
+        _exit(0);
+    }
+  }
+};
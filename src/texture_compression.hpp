@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+enum class TextureFormat : uint32_t {
+  RGBA8, BC1, BC3,
+};
+
+/* Images smaller than this are left uncompressed: they use little memory,
+ * and block artifacts are most visible on small icons. */
+static constexpr size_t MIN_COMPRESSED_SIZE = 64;
+
+static size_t texture_data_size(TextureFormat format, size_t width,
+                                size_t height) {
+  size_t blocks = ((width + 3) / 4) * ((height + 3) / 4);
+  switch (format) {
+  case TextureFormat::BC1: return blocks * 8;
+  case TextureFormat::BC3: return blocks * 16;
+  default:                 return width * height * 4;
+  }
+}
+
+/* Fast block encoder: the endpoints are the corners of the slightly inset
+ * bounding box of each block, and every pixel picks the closest palette
+ * entry. Good enough for icons and thumbnails, and cheap enough to run on
+ * the decoder threads. */
+namespace bc {
+  static uint16_t to_565(const uint8_t *color) {
+    return ((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3);
+  }
+
+  static void from_565(uint16_t packed, int *color) {
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+  }
+
+  /* Writes the 8-byte color part of a block, always in four-color mode. */
+  static void encode_color(const uint8_t block[16][4], uint8_t *out) {
+    uint8_t min[3] = {255, 255, 255}, max[3] = {0, 0, 0};
+    for (size_t i = 0; i < 16; i++) {
+      for (size_t c = 0; c < 3; c++) {
+        min[c] = std::min(min[c], block[i][c]);
+        max[c] = std::max(max[c], block[i][c]);
+      }
+    }
+
+    for (size_t c = 0; c < 3; c++) {
+      int inset = (max[c] - min[c]) >> 4;
+      min[c] = std::min(min[c] + inset, 255);
+      max[c] = std::max(max[c] - inset, 0);
+    }
+
+    uint16_t c0 = to_565(max), c1 = to_565(min);
+    if (c0 < c1)
+      std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+      int palette[4][3];
+      from_565(c0, palette[0]);
+      from_565(c1, palette[1]);
+      for (size_t c = 0; c < 3; c++) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+      }
+
+      for (size_t i = 0; i < 16; i++) {
+        int best = 0, best_dist = INT32_MAX;
+        for (int j = 0; j < 4; j++) {
+          int dist = 0;
+          for (size_t c = 0; c < 3; c++) {
+            int d = block[i][c] - palette[j][c];
+            dist += d * d;
+          }
+          if (dist < best_dist) {
+            best = j;
+            best_dist = dist;
+          }
+        }
+        indices |= (uint32_t)best << (2 * i);
+      }
+    }
+
+    out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+    out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+    memcpy(out + 4, &indices, 4);
+  }
+
+  /* Writes the 8-byte alpha part of a BC3 block, in eight-value mode. */
+  static void encode_alpha(const uint8_t block[16][4], uint8_t *out) {
+    uint8_t a0 = 0, a1 = 255;
+    for (size_t i = 0; i < 16; i++) {
+      a0 = std::max(a0, block[i][3]);
+      a1 = std::min(a1, block[i][3]);
+    }
+
+    uint64_t indices = 0;
+    if (a0 != a1) {
+      int palette[8] = {a0, a1};
+      for (int j = 2; j < 8; j++)
+        palette[j] = ((8 - j) * a0 + (j - 1) * a1 + 3) / 7;
+
+      for (size_t i = 0; i < 16; i++) {
+        int best = 0, best_dist = INT32_MAX;
+        for (int j = 0; j < 8; j++) {
+          int dist = std::abs(block[i][3] - palette[j]);
+          if (dist < best_dist) {
+            best = j;
+            best_dist = dist;
+          }
+        }
+        indices |= (uint64_t)best << (3 * i);
+      }
+    }
+
+    out[0] = a0;
+    out[1] = a1;
+    for (size_t i = 0; i < 6; i++)
+      out[2 + i] = (indices >> (8 * i)) & 0xFF;
+  }
+}
+
+/* Picks BC1 for opaque images and BC3 for everything else. */
+static TextureFormat choose_texture_format(const uint32_t *rgba, size_t width,
+                                           size_t height) {
+  if (width < MIN_COMPRESSED_SIZE || height < MIN_COMPRESSED_SIZE)
+    return TextureFormat::RGBA8;
+
+  const uint8_t *bytes = (const uint8_t*)rgba;
+  for (size_t i = 0; i < width * height; i++) {
+    if (bytes[i * 4 + 3] != 255)
+      return TextureFormat::BC3;
+  }
+
+  return TextureFormat::BC1;
+}
+
+/* Blocks overlapping the right or bottom edge repeat the last column or
+ * row. */
+static std::vector<uint8_t> compress_texture(const uint32_t *rgba,
+                                             size_t width, size_t height,
+                                             TextureFormat format) {
+  std::vector<uint8_t> out(texture_data_size(format, width, height));
+  uint8_t *dest = out.data();
+
+  const uint8_t *bytes = (const uint8_t*)rgba;
+  for (size_t by = 0; by < height; by += 4) {
+    for (size_t bx = 0; bx < width; bx += 4) {
+      uint8_t block[16][4];
+      for (size_t y = 0; y < 4; y++) {
+        size_t sy = std::min(by + y, height - 1);
+        for (size_t x = 0; x < 4; x++) {
+          size_t sx = std::min(bx + x, width - 1);
+          memcpy(block[y * 4 + x], bytes + (sy * width + sx) * 4, 4);
+        }
+      }
+
+      if (format == TextureFormat::BC3) {
+        bc::encode_alpha(block, dest);
+        dest += 8;
+      }
+
+      bc::encode_color(block, dest);
+      dest += 8;
+    }
+  }
+
+  return out;
+}
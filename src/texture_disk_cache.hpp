@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+#include <giomm.h>
+
+#include "icon.hpp"
+#include "icon_theme_index.hpp"
+#include "image_decoder.hpp"
+
+/* Compressed textures, stored on disk so that they do not need to be decoded
+ * and encoded again on the next start. There is one file per source image
+ * and requested size; it is only used while the modification time of the
+ * source matches the one it was encoded from.
+ *
+ * Entries are touched when they are used. Every PRUNE_INTERVAL stores,
+ * starting with the first one, the entries used the longest time ago are
+ * removed until the cache is back under PRUNED_SIZE, if it grew past
+ * MAX_SIZE. */
+class TextureDiskCache {
+  static constexpr char MAGIC[8] = {'L', 'O', 'O', 'T', 'E', 'X', '0', '1'};
+
+  static constexpr uint64_t MAX_SIZE = 256 * 1024 * 1024;
+  static constexpr uint64_t PRUNED_SIZE = MAX_SIZE / 4 * 3;
+  static constexpr size_t PRUNE_INTERVAL = 256;
+
+  struct Header {
+    char magic[8];
+    uint32_t format;
+    uint32_t width, height;
+    uint32_t path_size;
+    uint64_t hash;
+    int64_t mtime;
+    uint64_t size;
+    uint64_t data_size;
+  };
+
+  std::string dir;
+  std::atomic<size_t> stores = 0;
+
+public:
+  TextureDiskCache():
+    dir(Glib::build_filename(
+          Glib::get_user_cache_dir(),
+          Glib::build_filename("launcher-openvr-overlay", "textures"))) {
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+  }
+
+  std::optional<Icon> load(const std::string &path, size_t size) const {
+    std::string entry = entry_path(path, size);
+    MappedFile file(entry);
+    if (!file)
+      return std::nullopt;
+
+    auto data = file.data();
+    Header header;
+    if (data.size() < sizeof(header))
+      return std::nullopt;
+    memcpy(&header, data.data(), sizeof(header));
+
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.size != size ||
+        header.mtime != file_mtime(path) ||
+        header.format == (uint32_t)TextureFormat::RGBA8 ||
+        header.format > (uint32_t)TextureFormat::BC3 ||
+        header.width > MAX_IMAGE_SIZE || header.height > MAX_IMAGE_SIZE)
+      return std::nullopt;
+
+    auto format = (TextureFormat)header.format;
+    if (header.data_size !=
+        texture_data_size(format, header.width, header.height) ||
+        data.size() != sizeof(header) + header.path_size + header.data_size)
+      return std::nullopt;
+
+    const uint8_t *stored_path = data.data() + sizeof(header);
+    if (header.path_size != path.size() ||
+        memcmp(stored_path, path.data(), path.size()) != 0)
+      return std::nullopt;
+
+    utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+
+    const uint8_t *blocks = stored_path + header.path_size;
+    return Icon(format, std::vector<uint8_t>(blocks, blocks + header.data_size),
+                header.width, header.height, header.hash);
+  }
+
+  /* The modification time of the source has to be taken before it is
+   * read, so that an entry is never newer than what it was encoded from. */
+  void store(const std::string &path, size_t size, int64_t mtime,
+             const Icon &icon) {
+    if (icon.format == TextureFormat::RGBA8 || mtime == -1)
+      return;
+
+    if (stores++ % PRUNE_INTERVAL == 0)
+      prune();
+
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.format = (uint32_t)icon.format;
+    header.width = icon.width;
+    header.height = icon.height;
+    header.path_size = path.size();
+    header.hash = icon.hash;
+    header.mtime = mtime;
+    header.size = size;
+    header.data_size = icon.blocks.size();
+
+    /* Decoders may write entries concurrently, so each one uses its own
+     * temporary file. */
+    std::string dest = entry_path(path, size);
+    std::string tmp_path = dest + ".tmp" +
+      std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+      std::ofstream out(tmp_path, std::ios::binary);
+      out.write((const char*)&header, sizeof(header));
+      out.write(path.data(), path.size());
+      out.write((const char*)icon.blocks.data(), icon.blocks.size());
+      if (!out) {
+        out.close();
+        std::remove(tmp_path.c_str());
+        return;
+      }
+    }
+
+    std::rename(tmp_path.c_str(), dest.c_str());
+  }
+
+private:
+  void prune() const {
+    struct Entry {
+      std::filesystem::path path;
+      std::filesystem::file_time_type used;
+      uint64_t size;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+
+    std::error_code error;
+    for (auto it = std::filesystem::directory_iterator(dir, error);
+         !error && it != std::filesystem::directory_iterator();
+         it.increment(error)) {
+      std::error_code entry_error;
+      uint64_t size = it->file_size(entry_error);
+      auto used = it->last_write_time(entry_error);
+      if (entry_error)
+        continue;
+
+      entries.push_back(Entry{it->path(), used, size});
+      total += size;
+    }
+
+    if (total <= MAX_SIZE)
+      return;
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) { return a.used < b.used; });
+    for (const Entry &entry : entries) {
+      if (total <= PRUNED_SIZE)
+        break;
+      if (std::filesystem::remove(entry.path, error))
+        total -= entry.size;
+    }
+  }
+
+  std::string entry_path(const std::string &path, size_t size) const {
+    uint64_t key = 0xCBF29CE484222325ull;
+    for (char c : path + "\n" + std::to_string(size)) {
+      key ^= (uint8_t)c;
+      key *= 0x100000001B3ull;
+    }
+
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+    return Glib::build_filename(dir, name);
+  }
+};
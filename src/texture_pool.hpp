@@ -0,0 +1,226 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "memory_ledger.hpp"
+#include "texture_compression.hpp"
+
+static GLenum texture_internal_format(TextureFormat format) {
+  switch (format) {
+  case TextureFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  case TextureFormat::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  default:                 return GL_RGBA8;
+  }
+}
+
+/* Textures are allocated in multiples of 16 pixels, so that textures of
+ * nearly the same size can be reused for one another while wasting at most
+ * 15 rows and columns: a 129 pixel icon gets 144 pixels, not 192. */
+static size_t texture_size_class(size_t size) {
+  return std::max<size_t>((size + 15) / 16 * 16, 16);
+}
+
+/* Parts of the overlay that may limit how much free storage the pool keeps.
+ * Each one states its own limit, and the smallest of them applies. */
+enum class FreeLimitOwner {
+  IdleTrimmer, MemoryPressure, Count
+};
+
+struct PooledTexture {
+  GLuint name = 0;
+  TextureFormat format = TextureFormat::RGBA8;
+  size_t width = 0, height = 0;
+  size_t bytes = 0;
+};
+
+/* Recycles texture objects instead of creating and deleting them. Textures
+ * get immutable storage when ARB_texture_storage is available, and their
+ * contents are replaced with glTexSubImage2D.
+ *
+ * Released textures may still be referenced by draw data that was submitted
+ * but not executed yet. They are only reused, or deleted, once the fence
+ * inserted at the end of the frame in which they were released has
+ * signaled. Releasing makes no GL call, so it can happen on any thread;
+ * end_frame and clear must be called from the render thread. */
+class TexturePool {
+public:
+  static constexpr size_t DEFAULT_FREE_LIMIT = 32 * 1024 * 1024;
+
+private:
+
+  using Key = std::tuple<TextureFormat, size_t, size_t>;
+
+  struct PendingBatch {
+    GLsync fence;
+    std::vector<PooledTexture> textures;
+  };
+
+  std::mutex mutex;
+  std::map<Key, std::vector<PooledTexture>> free_textures;
+  size_t free_bytes = 0;
+
+  /* Free textures beyond this are deleted rather than kept for reuse. It is
+   * the smallest of the limits requested by each owner. */
+  size_t free_limit = DEFAULT_FREE_LIMIT;
+  std::array<size_t, (size_t)FreeLimitOwner::Count> free_limits = [] {
+    std::array<size_t, (size_t)FreeLimitOwner::Count> limits;
+    limits.fill(DEFAULT_FREE_LIMIT);
+    return limits;
+  }();
+
+  std::vector<PooledTexture> released;
+  std::deque<PendingBatch> pending;
+
+  MemoryCharge charge{MemoryCategory::TexturePool, 0};
+
+public:
+  static TexturePool &get() {
+    static TexturePool pool;
+    return pool;
+  }
+
+  /* Returns a texture of at least the requested size. Must be called with a
+   * current GL context. */
+  PooledTexture acquire(TextureFormat format, size_t width, size_t height) {
+    width = texture_size_class(width);
+    height = texture_size_class(height);
+    size_t bytes = texture_data_size(format, width, height);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = free_textures.find(Key{format, width, height});
+      if (it != free_textures.end() && !it->second.empty()) {
+        PooledTexture texture = it->second.back();
+        it->second.pop_back();
+        free_bytes -= texture.bytes;
+        charge.set(free_bytes);
+        return texture;
+      }
+    }
+
+    PooledTexture texture{0, format, width, height, bytes};
+    glGenTextures(1, &texture.name);
+    glBindTexture(GL_TEXTURE_2D, texture.name);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    GLenum internal_format = texture_internal_format(format);
+    if (GLEW_ARB_texture_storage)
+      glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+    else if (format == TextureFormat::RGBA8) {
+      glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0,
+                   GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    else {
+      /* Compressed textures cannot be allocated without data. */
+      std::vector<uint8_t> zeros(bytes);
+      glCompressedTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height,
+                             0, bytes, zeros.data());
+    }
+
+    return texture;
+  }
+
+  void release(const PooledTexture &texture) {
+    if (!texture.name)
+      return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    released.push_back(texture);
+  }
+
+  /* Fences the textures released during this frame, and recycles those
+   * released during frames the GPU is done with. */
+  void end_frame() {
+    std::vector<PooledTexture> to_delete;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!released.empty()) {
+        pending.push_back(PendingBatch{
+            glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0),
+            std::move(released)});
+        released.clear();
+      }
+
+      while (!pending.empty() &&
+             glClientWaitSync(pending.front().fence, 0, 0) !=
+             GL_TIMEOUT_EXPIRED) {
+        glDeleteSync(pending.front().fence);
+        for (const PooledTexture &texture : pending.front().textures) {
+          if (free_bytes + texture.bytes > free_limit)
+            to_delete.push_back(texture);
+          else {
+            free_textures[Key{texture.format, texture.width, texture.height}]
+              .push_back(texture);
+            free_bytes += texture.bytes;
+          }
+        }
+        pending.pop_front();
+      }
+
+      charge.set(free_bytes);
+    }
+
+    for (const PooledTexture &texture : to_delete)
+      glDeleteTextures(1, &texture.name);
+  }
+
+  /* Changes how much free storage the given owner lets the pool keep for
+   * reuse, deleting textures beyond the resulting limit. Must be called
+   * from the render thread. */
+  void set_free_limit(FreeLimitOwner owner, size_t bytes) {
+    std::vector<PooledTexture> to_delete;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      free_limits[(size_t)owner] = bytes;
+      free_limit = *std::min_element(free_limits.begin(), free_limits.end());
+      for (auto it = free_textures.begin();
+           it != free_textures.end() && free_bytes > free_limit; ++it) {
+        while (!it->second.empty() && free_bytes > free_limit) {
+          to_delete.push_back(it->second.back());
+          free_bytes -= it->second.back().bytes;
+          it->second.pop_back();
+        }
+      }
+      charge.set(free_bytes);
+    }
+
+    for (const PooledTexture &texture : to_delete)
+      glDeleteTextures(1, &texture.name);
+  }
+
+  /* Deletes every texture the pool holds, waiting for the GPU if needed. */
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    glFinish();
+
+    for (PendingBatch &batch : pending) {
+      glDeleteSync(batch.fence);
+      released.insert(released.end(), batch.textures.begin(),
+                      batch.textures.end());
+    }
+    pending.clear();
+
+    for (auto &[key, textures] : free_textures)
+      released.insert(released.end(), textures.begin(), textures.end());
+    free_textures.clear();
+    free_bytes = 0;
+    charge.set(0);
+
+    for (const PooledTexture &texture : released)
+      glDeleteTextures(1, &texture.name);
+    released.clear();
+  }
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "gl_texture.hpp"
+#include "icon.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/* Textures shared by every icon with the same pixels, keyed by the icon's
+ * content hash. The table only holds weak references: a texture is deleted
+ * once no icon uses it anymore. */
+class TextureTable {
+  struct Entry {
+    size_t width, height;
+    std::weak_ptr<GLTexture> texture;
+  };
+
+  std::mutex mutex;
+  std::unordered_map<uint64_t, Entry> textures;
+  size_t sweep_size = 64;
+
+public:
+  /* A live texture with the same pixels as the icon, if there is one. */
+  std::shared_ptr<GLTexture> find(const Icon &icon) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = textures.find(icon.hash);
+    if (it != textures.end() && it->second.width == icon.width &&
+        it->second.height == icon.height)
+      return it->second.texture.lock();
+
+    return nullptr;
+  }
+
+  /* Registers a texture uploaded for the given content hash. If another
+   * thread uploaded the same pixels in the meantime, its texture is returned
+   * instead and the new one is dropped. */
+  std::shared_ptr<GLTexture> insert(uint64_t hash,
+                                    std::shared_ptr<GLTexture> texture) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = textures.find(hash);
+    if (it != textures.end() && it->second.width == texture->width() &&
+        it->second.height == texture->height()) {
+      if (auto existing = it->second.texture.lock())
+        return existing;
+    }
+
+    textures[hash] = Entry{texture->width(), texture->height(), texture};
+
+    if (textures.size() >= sweep_size) {
+      std::erase_if(textures, [](const auto &entry) {
+        return entry.second.texture.expired();
+      });
+      sweep_size = std::max<size_t>(64, textures.size() * 2);
+    }
+
+    return texture;
+  }
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "gl_texture.hpp"
+#include "icon.hpp"
+#include "texture_table.hpp"
+#include "thread_role.hpp"
+
+#include <GL/glew.h>
+#include <SDL.h>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <tbb/concurrent_queue.h>
+
+/* Uploads textures from a thread of its own, on a GL context shared with
+ * the one used for rendering. Pixels are streamed through a pixel unpack
+ * buffer, and each texture is only handed to its callback once the fence
+ * placed after its upload has signaled, so the render thread never sees a
+ * texture that is still being written.
+ *
+ * Callbacks run on the upload thread. Icons with the same pixels as a live
+ * texture reuse it without being uploaded again. */
+class TextureUploader {
+public:
+  using Callback = std::function<void(std::shared_ptr<GLTexture>)>;
+
+private:
+  /* Uploads issued before waiting on their fences. */
+  static constexpr size_t MAX_IN_FLIGHT = 16;
+
+  struct Job {
+    Icon icon;
+    Callback done;
+  };
+
+  struct InFlight {
+    uint64_t hash;
+    std::shared_ptr<GLTexture> texture;
+    GLsync fence;
+    Callback done;
+  };
+
+  SDL_Window *window;
+  SDL_GLContext context;
+  GLuint pbo = 0;
+
+  TextureTable &textures;
+
+  tbb::concurrent_bounded_queue<std::optional<Job>> queue;
+  std::jthread upload_thread;
+
+public:
+  /* Must be constructed on the render thread, with its context current. */
+  TextureUploader(SDL_Window *window, SDL_GLContext render_context,
+                  TextureTable &textures):
+    window(window),
+    textures(textures) {
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    context = SDL_GL_CreateContext(window);
+    SDL_GL_MakeCurrent(window, render_context);
+
+    upload_thread = std::jthread([this]() { upload_from_queue(); });
+  }
+
+  ~TextureUploader() {
+    queue.emplace(std::nullopt);
+    upload_thread.join();
+    SDL_GL_DeleteContext(context);
+  }
+
+  TextureUploader(const TextureUploader&) = delete;
+  TextureUploader &operator=(const TextureUploader&) = delete;
+
+  void upload(Icon &&icon, Callback done) {
+    queue.emplace(Job{std::move(icon), std::move(done)});
+  }
+
+private:
+  void upload_from_queue() {
+    set_thread_role(ThreadRole::InteractiveIO, "tex-uploader");
+    SDL_GL_MakeCurrent(window, context);
+
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+
+    std::vector<InFlight> in_flight;
+    std::optional<Job> job;
+    bool running = true;
+    while (running) {
+      queue.pop(job);
+      do {
+        if (!job) {
+          running = false;
+          break;
+        }
+
+        if (auto texture = textures.find(job->icon))
+          job->done(std::move(texture));
+        else
+          in_flight.push_back(start_upload(job->icon, std::move(job->done)));
+      } while (in_flight.size() < MAX_IN_FLIGHT && queue.try_pop(job));
+
+      glFlush();
+      for (InFlight &upload : in_flight) {
+        while (glClientWaitSync(upload.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                1000000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(upload.fence);
+
+        upload.done(textures.insert(upload.hash, std::move(upload.texture)));
+      }
+      in_flight.clear();
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &pbo);
+    SDL_GL_MakeCurrent(window, nullptr);
+  }
+
+  /* The buffer is orphaned before each upload, so the driver can hand out
+   * fresh storage while earlier transfers are still pending. */
+  InFlight start_upload(const Icon &icon, Callback &&done) {
+    const void *data;
+    size_t data_size;
+    if (icon.format == TextureFormat::RGBA8) {
+      data = icon.rgba_data.data();
+      data_size = icon.rgba_data.size() * 4;
+    }
+    else {
+      data = icon.blocks.data();
+      data_size = icon.blocks.size();
+    }
+
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, data_size, nullptr, GL_STREAM_DRAW);
+    void *dest = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, data_size,
+                                  GL_MAP_WRITE_BIT |
+                                  GL_MAP_INVALIDATE_BUFFER_BIT);
+    auto texture = std::make_shared<GLTexture>();
+    if (dest) {
+      memcpy(dest, data, data_size);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      texture->load(icon.format, nullptr, data_size, icon.width, icon.height);
+    }
+    else {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      texture->load(icon);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    }
+
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    return InFlight{icon.hash, std::move(texture), fence, std::move(done)};
+  }
+};
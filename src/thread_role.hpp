@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Who would define C as 1? */
+#ifdef C
+#undef C
+#endif
+
+#include <tbb/parallel_for.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+
+/* What a thread does, which decides how it competes for the CPU and the
+ * disk with the VR compositor and the game:
+ *
+ * - Render: the main thread, drawing the overlay every frame.
+ * - Input: small, latency-sensitive jobs such as monitoring memory
+ *   pressure.
+ * - InteractiveIO: work the user is waiting for, like resolving icons,
+ *   uploading textures or querying file info. Slightly lower priority.
+ * - Background: scans and decoders, which only get CPU time and disk
+ *   bandwidth nobody else wants.
+ *
+ * Threads of a role can be pinned to a set of CPUs through the
+ * LAUNCHER_OVERLAY_CPUS_<ROLE> environment variables, e.g.
+ * LAUNCHER_OVERLAY_CPUS_BACKGROUND=0-1,6. */
+enum class ThreadRole {
+  Render, Input, InteractiveIO, Background,
+};
+
+struct ThreadRoleSettings {
+  const char *env_name;
+  int policy;
+  int nice;
+  int io_class;
+  int io_level;
+};
+
+/* Values of the I/O priority classes, see ioprio_set(2). */
+static constexpr int IOPRIO_CLASS_BE = 2;
+static constexpr int IOPRIO_CLASS_IDLE = 3;
+
+static const ThreadRoleSettings THREAD_ROLE_SETTINGS[] = {
+  {"LAUNCHER_OVERLAY_CPUS_RENDER", SCHED_OTHER, 0, IOPRIO_CLASS_BE, 0},
+  {"LAUNCHER_OVERLAY_CPUS_INPUT", SCHED_OTHER, 0, IOPRIO_CLASS_BE, 2},
+  {"LAUNCHER_OVERLAY_CPUS_INTERACTIVE", SCHED_OTHER, 5, IOPRIO_CLASS_BE, 4},
+  {"LAUNCHER_OVERLAY_CPUS_BACKGROUND", SCHED_IDLE, 19, IOPRIO_CLASS_IDLE, 0},
+};
+
+/* Parses a list of CPUs and ranges such as "0-3,8". */
+static std::optional<cpu_set_t> parse_cpu_list(const char *list) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  bool any = false;
+  const char *ptr = list;
+  while (*ptr) {
+    char *end;
+    long first = strtol(ptr, &end, 10);
+    if (end == ptr || first < 0)
+      return std::nullopt;
+
+    long last = first;
+    if (*end == '-') {
+      ptr = end + 1;
+      last = strtol(ptr, &end, 10);
+      if (end == ptr || last < first)
+        return std::nullopt;
+    }
+
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, &set);
+      any = true;
+    }
+
+    ptr = end;
+    if (*ptr == ',')
+      ptr++;
+    else if (*ptr)
+      return std::nullopt;
+  }
+
+  if (!any)
+    return std::nullopt;
+
+  return set;
+}
+
+/* Applies a role to the calling thread and names it for debuggers and
+ * profilers (at most 15 characters are kept). Lowering the priority never
+ * needs privileges; anything the system refuses is left as is. */
+static void set_thread_role(ThreadRole role, const char *name) {
+  const ThreadRoleSettings &settings = THREAD_ROLE_SETTINGS[(size_t)role];
+  pid_t tid = syscall(SYS_gettid);
+
+  std::string short_name(name, 0, 15);
+  pthread_setname_np(pthread_self(), short_name.c_str());
+
+  sched_param param{};
+  sched_setscheduler(0, settings.policy, &param);
+
+  if (settings.nice != 0)
+    setpriority(PRIO_PROCESS, tid, settings.nice);
+
+  int ioprio = (settings.io_class << 13) | settings.io_level;
+  syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, tid, ioprio);
+
+  if (const char *cpus = getenv(settings.env_name)) {
+    if (auto set = parse_cpu_list(cpus))
+      pthread_setaffinity_np(pthread_self(), sizeof(*set), &*set);
+  }
+}
+
+/* TBB starts its worker threads when work is first shared, from the thread
+ * sharing it or from other workers, and threads inherit the policy, nice
+ * value and I/O priority of the thread creating them. Raising them back
+ * takes privileges. If a Background thread were the first to use TBB,
+ * every worker would be idle-scheduled, and the render thread would wait
+ * on them for its own parallel work.
+ *
+ * Called from the render thread before any other thread starts: each task
+ * waits until every thread of the arena took one, so that all workers are
+ * started with the priority of the render thread, and kept afterwards. */
+static void start_task_workers() {
+  size_t count = tbb::this_task_arena::max_concurrency();
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+  std::atomic<size_t> started = 0;
+  tbb::parallel_for(
+    size_t(0), count, size_t(1),
+    [&](size_t) {
+      started++;
+      while (started < count && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+    },
+    tbb::static_partitioner());
+}
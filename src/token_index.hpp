@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/* Splits a search key into words. Bytes of multi-byte UTF-8 sequences are
+ * kept in words; any other character that is not a letter or a digit
+ * separates them. */
+static std::vector<std::string> split_tokens(std::string_view key) {
+  std::vector<std::string> tokens;
+  std::string token;
+  for (unsigned char c : key) {
+    if (c >= 0x80 || isalnum(c))
+      token.push_back(c);
+    else if (!token.empty()) {
+      tokens.push_back(std::move(token));
+      token.clear();
+    }
+  }
+
+  if (!token.empty())
+    tokens.push_back(std::move(token));
+
+  return tokens;
+}
+
+/* Inverted index from words to the documents containing them. Words are
+ * kept sorted so that all the words starting with a prefix are next to each
+ * other, and looking up a query only reads the posting lists of the words it
+ * matches.
+ *
+ * Documents can be inserted and erased one at a time, which only touches the
+ * posting lists of their own words. */
+class TokenIndex {
+  /* Document ids, sorted. */
+  using PostingList = std::vector<uint32_t>;
+
+  std::map<std::string, PostingList, std::less<>> postings;
+  std::unordered_map<uint32_t, std::vector<std::string>> documents;
+
+public:
+  size_t size() const { return documents.size(); }
+  size_t token_count() const { return postings.size(); }
+
+  void insert(uint32_t id, std::vector<std::string> tokens) {
+    erase(id);
+
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+
+    for (const std::string &token : tokens) {
+      PostingList &list = postings[token];
+      list.insert(std::lower_bound(list.begin(), list.end(), id), id);
+    }
+
+    documents[id] = std::move(tokens);
+  }
+
+  void erase(uint32_t id) {
+    auto it = documents.find(id);
+    if (it == documents.end())
+      return;
+
+    for (const std::string &token : it->second) {
+      auto posting = postings.find(token);
+      PostingList &list = posting->second;
+      list.erase(std::lower_bound(list.begin(), list.end(), id));
+      if (list.empty())
+        postings.erase(posting);
+    }
+
+    documents.erase(it);
+  }
+
+  void clear() {
+    postings.clear();
+    documents.clear();
+  }
+
+  /* Documents containing a word starting with the prefix, sorted. */
+  PostingList prefix_lookup(std::string_view prefix) const {
+    PostingList result;
+    for (auto it = postings.lower_bound(prefix);
+         it != postings.end() && it->first.starts_with(prefix); it++) {
+      size_t middle = result.size();
+      result.insert(result.end(), it->second.begin(), it->second.end());
+      std::inplace_merge(result.begin(), result.begin() + middle,
+                         result.end());
+    }
+
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+  }
+
+  /* Documents where every word of the query is the prefix of a word, sorted.
+   * The query must already be normalized by search_key. */
+  PostingList lookup(std::string_view query) const {
+    std::vector<std::string> words = split_tokens(query);
+    if (words.empty())
+      return {};
+
+    PostingList result = prefix_lookup(words[0]);
+    for (size_t i = 1; i < words.size() && !result.empty(); i++) {
+      PostingList other = prefix_lookup(words[i]);
+      PostingList both;
+      std::set_intersection(result.begin(), result.end(),
+                            other.begin(), other.end(),
+                            std::back_inserter(both));
+      result = std::move(both);
+    }
+
+    return result;
+  }
+};
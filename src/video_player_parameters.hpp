@@ -14,6 +14,8 @@ static const char *PROJECTION_NAMES[] = {
 };
 
 struct VideoPlayerParameters {
+  static constexpr const char *PROGRAM = "vr-video-player";
+
   bool overlay;
   bool overlay_mouse;
   float zoom;
@@ -59,7 +61,7 @@ struct VideoPlayerParameters {
               std::chrono::milliseconds(1);
 
     std::vector<std::string> args = {
-      Glib::find_program_in_path("vr-video-player"),
+      PROGRAM,
       overlay_mouse ? "--overlay-mouse" : "--no-overlay-mouse",
       "--overlay-key",
       "launcher-openvr-overlay-" + std::to_string(ms),
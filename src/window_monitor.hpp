@@ -2,12 +2,18 @@
 
 #include "gl_texture.hpp"
 #include "icon.hpp"
+#include "launch_queue.hpp"
+#include "memory_ledger.hpp"
+#include "texture_uploader.hpp"
+#include "thread_role.hpp"
 #include "video_player_parameters.hpp"
+#include "xlib_errors.hpp"
 
-#include <SDL_video.h>
 #include <X11/Xlib.h>
 #include <atomic>
 #include <filesystem>
+#include <future>
+#include <memory>
 #include <optional>
 #include <iostream>
 #include <thread>
@@ -15,30 +21,11 @@
 struct WindowEntry {
   Window id;
   std::optional<std::string> title;
-  std::optional<Icon> icon;
-  std::optional<GLTexture> texture;
+  std::shared_ptr<GLTexture> texture;
 
-  std::optional<GLTexture> &get_texture() {
-    if (icon.has_value() && !texture.has_value()) {
-      texture.emplace();
-      texture->load(*icon);
-    }
-
-    return texture;
-  }
+  MemoryCharge charge{MemoryCategory::WindowEntries, sizeof(WindowEntry)};
 };
 
-static Window last_bad_id = None;
-
-static int on_xlib_error(Display *display, XErrorEvent *ev) {
-  (void)display;
-
-  if (ev->error_code == BadWindow) {
-    last_bad_id = ev->resourceid;
-  }
-  return 0;
-}
-
 class WindowMonitor {
   std::vector<WindowEntry> window_entries;
 
@@ -49,14 +36,17 @@ class WindowMonitor {
   Atom utf8_atom;
   Atom icon_atom;
 
-  std::atomic<bool> is_shown;
+  std::atomic<bool> is_shown{false};
+
+  TextureUploader &uploader;
+  LaunchQueue &launches;
 
   std::mutex mutex;
   std::jthread updater_thread;
 public:
-  WindowMonitor(SDL_Window *window, SDL_GLContext context) {
+  WindowMonitor(TextureUploader &uploader, LaunchQueue &launches):
+    uploader(uploader), launches(launches) {
     display = XOpenDisplay(NULL);
-    XInitThreads();
 
     if (!display) return;
 
@@ -65,17 +55,24 @@ public:
     utf8_atom = XInternAtom(display, "UTF8_STRING", False);
     icon_atom = XInternAtom(display, "_NET_WM_ICON", False);
 
-    updater_thread = std::jthread([this, window, context](std::stop_token token) {
-      update(token, window, context);
+    updater_thread = std::jthread([this](std::stop_token token) {
+      update(token);
     });
   }
 
+  /* Window icons come back with the next refresh of the window list. */
+  void drop_textures() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (WindowEntry &entry : window_entries)
+      entry.texture.reset();
+  }
+
   void show() {
     is_shown.store(true, std::memory_order_release);
   }
 
   void hide() {
-    is_shown.store(true, std::memory_order_release);
+    is_shown.store(false, std::memory_order_release);
   }
 
   void draw(VideoPlayerParameters &player_params) {
@@ -106,7 +103,7 @@ public:
 
           ImVec2 button_size(width, width);
 
-          auto &tex = entry.get_texture();
+          auto &tex = entry.texture;
           bool clicked = false;
           if (tex) {
             if (tex->draw_button(button_size))
@@ -115,6 +112,7 @@ public:
             if (ImGui::Button("Capture", button_size))
               clicked = true;
           }
+          bool hovered = ImGui::IsItemHovered();
 
           ImGui::TableNextColumn();
 
@@ -125,16 +123,20 @@ public:
           if (ImGui::Button(entry.title.value_or("?").c_str(),
                             title_button_size))
             clicked = true;
+          hovered |= ImGui::IsItemHovered();
+
+          if (hovered)
+            launches.warm(VideoPlayerParameters::PROGRAM);
 
           if (clicked) {
             auto args = player_params.command_line();
             args.push_back(std::to_string(entry.id));
 
-            try {
-              Glib::spawn_async(std::filesystem::current_path(), args);
-            } catch (const Glib::SpawnError &e) {
-              std::cerr << "spawn error: " << e.what() << "\n";
-            }
+            LaunchCommand command;
+            command.overlay_key = overlay_key_argument(args);
+            command.argv = std::move(args);
+            launches.launch("window:" + std::to_string(entry.id),
+                            entry.title.value_or("?"), std::move(command));
           }
         }
 
@@ -150,31 +152,27 @@ public:
   }
 
 private:
-  void update(std::stop_token token, SDL_Window *sdl_window, SDL_GLContext context) {
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
-
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
-                        SDL_GL_CONTEXT_PROFILE_CORE);
-    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
-
-    SDL_GL_MakeCurrent(sdl_window, context);
-    SDL_GLContext new_context = SDL_GL_CreateContext(sdl_window);
-
-    SDL_GL_MakeCurrent(sdl_window, new_context);
-
-    XSetErrorHandler(on_xlib_error);
+  void update(std::stop_token token) {
+    set_thread_role(ThreadRole::Background, "window-monitor");
 
     while (!token.stop_requested()) {
       if (!is_shown.load(std::memory_order_acquire)) {
         std::vector<Window> windows = get_window_list();
         std::vector<WindowEntry> entries;
+        std::vector<std::future<std::shared_ptr<GLTexture>>> textures;
         for (Window window : windows) {
+          auto icon = best_icon(window);
           WindowEntry info = window_info(window);
-          if (last_bad_id != window)
+          if (last_bad_window(display) != window) {
             entries.emplace_back() = std::move(info);
+            textures.push_back(upload(std::move(icon)));
+          }
         }
 
+        /* Entries are only published once their icons are on the GPU. */
+        for (size_t i = 0; i < entries.size(); i++)
+          entries[i].texture = textures[i].get();
+
         {
           std::lock_guard<std::mutex> lock(mutex);
           window_entries = std::move(entries);
@@ -226,11 +224,29 @@ private:
     WindowEntry entry;
     entry.id = window;
     entry.title = window_name(window);
-    entry.icon = best_icon(window);
+    entry.charge.set(sizeof(WindowEntry) +
+                     (entry.title ? entry.title->capacity() : 0));
 
     return entry;
   }
 
+  std::future<std::shared_ptr<GLTexture>> upload(std::optional<Icon> icon) {
+    auto promise =
+      std::make_shared<std::promise<std::shared_ptr<GLTexture>>>();
+    auto future = promise->get_future();
+
+    if (icon) {
+      uploader.upload(std::move(*icon),
+                      [promise](std::shared_ptr<GLTexture> texture) {
+                        promise->set_value(std::move(texture));
+                      });
+    }
+    else
+      promise->set_value(nullptr);
+
+    return future;
+  }
+
   std::optional<std::string> window_name(Window window) {
     unsigned char *props = NULL;
 
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <X11/Xlib.h>
+#include <mutex>
+#include <unordered_map>
+
+/* Windows may disappear while they are being looked at. Xlib reports errors
+ * through one handler for the whole process, which would exit by default:
+ * BadWindow errors are ignored instead, and the window they were about is
+ * remembered for the display the request went through, so that threads with
+ * a display of their own do not see each other's errors. */
+static std::mutex xlib_error_mutex;
+static std::unordered_map<Display*, Window> last_bad_windows;
+
+static int on_xlib_error(Display *display, XErrorEvent *ev) {
+  if (ev->error_code == BadWindow) {
+    std::lock_guard<std::mutex> lock(xlib_error_mutex);
+    last_bad_windows[display] = ev->resourceid;
+  }
+  return 0;
+}
+
+/* Called at the very start of main, since XInitThreads has to be the first
+ * Xlib call of the process, before any thread opens a display. */
+static void init_xlib() {
+  XInitThreads();
+  XSetErrorHandler(on_xlib_error);
+}
+
+/* Last window a request through the display failed on, or None. */
+static Window last_bad_window(Display *display) {
+  std::lock_guard<std::mutex> lock(xlib_error_mutex);
+  auto it = last_bad_windows.find(display);
+  return it != last_bad_windows.end() ? it->second : None;
+}
+
+static void close_display(Display *display) {
+  {
+    std::lock_guard<std::mutex> lock(xlib_error_mutex);
+    last_bad_windows.erase(display);
+  }
+
+  XCloseDisplay(display);
+}